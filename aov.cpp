@@ -0,0 +1,71 @@
+#include "aov.h"
+#include "image_output.h"
+
+#include <cmath>
+
+void AOVSample::reset(size_t num_lights) {
+    hit = false;
+    depth = 0.0;
+    normal = albedo = vector3(0.0, 0.0, 0.0);
+    light.assign(num_lights, vector3(0.0, 0.0, 0.0));
+}
+
+AOVSample*& active_aov() {
+    static thread_local AOVSample* aov = nullptr;
+    return aov;
+}
+
+void AOVBuffer::resize(int w, int h, size_t lights) {
+    width = w;
+    height = h;
+    num_lights = lights;
+    samples.assign(w * h, 0);
+    hits.assign(w * h, 0);
+    depth.assign(w * h, 0.0);
+    normal.assign(w * h, vector3(0.0, 0.0, 0.0));
+    albedo.assign(w * h, vector3(0.0, 0.0, 0.0));
+    light.assign(w * h * lights, vector3(0.0, 0.0, 0.0));
+}
+
+void AOVBuffer::add(int index, const AOVSample& sample) {
+    samples[index]++;
+    if (!sample.hit) return;
+    hits[index]++;
+    depth[index] += sample.depth;
+    normal[index] += sample.normal;
+    albedo[index] += sample.albedo;
+    for (size_t l = 0; l < num_lights; ++l) light[index * num_lights + l] += sample.light[l];
+}
+
+bool write_aovs(const std::string& filename, const std::vector<vector3>& beauty, const AOVBuffer& aovs) {
+    const size_t pixels = beauty.size();
+    std::vector<ImageChannel> channels;
+    auto add_rgb = [&](const std::string& layer, const char* names, auto value) {
+        for (int c = 0; c < 3; ++c) {
+            ImageChannel channel{layer.empty() ? std::string(1, names[c]) : layer + "." + names[c], {}};
+            channel.values.resize(pixels);
+            for (size_t i = 0; i < pixels; ++i) {
+                vector3 v = value(i);
+                channel.values[i] = c == 0 ? v.x : c == 1 ? v.y : v.z;
+            }
+            channels.push_back(std::move(channel));
+        }
+    };
+    auto per_sample = [&](size_t i) { return 1.0 / std::max(aovs.samples[i], 1); };
+    auto per_hit = [&](size_t i) { return 1.0 / std::max(aovs.hits[i], 1); };
+
+    add_rgb("", "RGB", [&](size_t i) { return beauty[i]; });
+    add_rgb("normal", "XYZ", [&](size_t i) { return aovs.normal[i] * per_hit(i); });
+    add_rgb("albedo", "RGB", [&](size_t i) { return aovs.albedo[i] * per_sample(i); });
+    for (size_t l = 0; l < aovs.num_lights; ++l) {
+        add_rgb("light" + std::to_string(l), "RGB", [&](size_t i) { return aovs.light[i * aovs.num_lights + l] * per_sample(i); });
+    }
+
+    ImageChannel depth{"Z", std::vector<float>(pixels)};
+    for (size_t i = 0; i < pixels; ++i) {
+        depth.values[i] = aovs.hits[i] ? aovs.depth[i] * per_hit(i) : INFINITY;
+    }
+    channels.push_back(std::move(depth));
+
+    return write_exr(filename, channels, aovs.width, aovs.height);
+}
@@ -0,0 +1,41 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include <string>
+#include <vector>
+#include "vector3.h"
+
+// What the shading code learns about the first surface a camera ray hits
+struct AOVSample {
+    bool hit = false;
+    double depth = 0.0;             // distance along the camera ray
+    vector3 normal, albedo;
+    std::vector<vector3> light;     // direct light from each scene light, shadowed
+
+    void reset(size_t num_lights);
+};
+
+// The AOVSample filled in for the camera ray traced on this thread, or null when no AOVs are wanted.
+// Only the first surface is recorded, so secondary rays leave it alone
+AOVSample*& active_aov();
+
+// Per-pixel sums of AOVSamples. Depth and normal average over the samples that hit something
+// (depth is infinite where none did); albedo and the light layers average over all samples, so the
+// light layers add up to the direct part of the beauty image
+struct AOVBuffer {
+    int width = 0, height = 0;
+    size_t num_lights = 0;
+    std::vector<int> samples, hits;
+    std::vector<double> depth;
+    std::vector<vector3> normal, albedo;
+    std::vector<vector3> light;     // num_lights entries per pixel
+
+    void resize(int w, int h, size_t lights);
+    void add(int index, const AOVSample& sample);
+};
+
+// One multi-layer half-float EXR: beauty as R, G, B plus the layers Z, normal.XYZ, albedo.RGB and
+// light<i>.RGB per light
+bool write_aovs(const std::string& filename, const std::vector<vector3>& beauty, const AOVBuffer& aovs);
+
+#endif
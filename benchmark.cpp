@@ -0,0 +1,379 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <functional>
+#include <cstdio>
+
+#include "benchmark.h"
+#include "camera.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "bvh.h"
+#include "scene.h"
+#include "utils.h"
+#include "sampler.h"
+#include "image_output.h"
+#include "cpu_dispatch.h"
+#include "tone_mapping.h"
+
+int run_benchmark(const std::string& name, int argc, char* argv[]) {
+    if (name == "packets") {
+        benchmark_packets();
+        return 0;
+    }
+    if (name == "isa") {
+        benchmark_isa();
+        return 0;
+    }
+    std::cerr << "Unknown benchmark: " << name << "\n";
+    return 1;
+}
+
+int run_scene_benchmark(const std::string& name, const Scene& scene, const Camera& camera, int width, int height, int nbounces) {
+    if (name == "primary") {
+        benchmark_primary_rays(scene, camera, width, height);
+        return 0;
+    }
+    if (name == "samplers") {
+        benchmark_samplers(scene, camera, width, height, nbounces);
+        return 0;
+    }
+    if (name == "output") {
+        benchmark_output(scene, camera, width, height, nbounces);
+        return 0;
+    }
+    std::cerr << "Unknown scene benchmark: " << name << "\n";
+    return 1;
+}
+
+// Times `passes` runs of `body` and returns rays per second; `hits` is from a single pass
+static double time_rays(int passes, size_t num_rays, const std::function<long()>& body, long& hits) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < passes; ++i) {
+        hits = body();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return passes * num_rays / elapsed.count();
+}
+
+// Rays for one frame, generated up front so only the intersection tests are timed.
+// The frame is kept small enough to stay in cache, otherwise both paths just measure memory bandwidth
+struct BenchmarkRays {
+    std::vector<ray> scalar;
+    std::vector<ray_packet<4>> packets4;
+    std::vector<ray_packet<8>> packets8;
+
+    // Width must be a multiple of 8 so every row splits into whole packets
+    BenchmarkRays(const Camera& camera, int width, int height) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                scalar.push_back(camera.get_ray((x + 0.5) / width, (y + 0.5) / height));
+            }
+            for (int x = 0; x < width; x += 4) {
+                doublexN<4> u, v;
+                for (int i = 0; i < 4; ++i) { u[i] = (x + i + 0.5) / width; v[i] = (y + 0.5) / height; }
+                packets4.push_back(camera.get_ray(u, v));
+            }
+            for (int x = 0; x < width; x += 8) {
+                doublexN<8> u, v;
+                for (int i = 0; i < 8; ++i) { u[i] = (x + i + 0.5) / width; v[i] = (y + 0.5) / height; }
+                packets8.push_back(camera.get_ray(u, v));
+            }
+        }
+    }
+};
+
+// Runs the scalar, 4-wide and 8-wide variants of one intersection test over the same rays
+template <typename ScalarTest, typename PacketTest4, typename PacketTest8>
+static void compare(const std::string& label, const BenchmarkRays& rays,
+                    ScalarTest scalar, PacketTest4 packet4, PacketTest8 packet8) {
+    const int passes = 200;
+    const size_t num_rays = rays.scalar.size();
+
+    long scalar_hits = 0, hits4 = 0, hits8 = 0;
+    double scalar_rate = time_rays(passes, num_rays, [&]() {
+        long hits = 0;
+        for (const ray& r : rays.scalar) hits += scalar(r);
+        return hits;
+    }, scalar_hits);
+
+    double rate4 = time_rays(passes, num_rays, [&]() {
+        long hits = 0;
+        for (const auto& r : rays.packets4) hits += packet4(r).count();
+        return hits;
+    }, hits4);
+
+    double rate8 = time_rays(passes, num_rays, [&]() {
+        long hits = 0;
+        for (const auto& r : rays.packets8) hits += packet8(r).count();
+        return hits;
+    }, hits8);
+
+    std::cout << label << ":\n"
+              << "  scalar   " << scalar_rate / 1e6 << " Mrays/s (" << scalar_hits << " hits)\n"
+              << "  packet4  " << rate4 / 1e6 << " Mrays/s (" << hits4 << " hits, x" << rate4 / scalar_rate << ")\n"
+              << "  packet8  " << rate8 / 1e6 << " Mrays/s (" << hits8 << " hits, x" << rate8 / scalar_rate << ")\n";
+}
+
+void benchmark_packets() {
+    const int width = 64, height = 64;
+    Camera camera(width, height, 45.0, vector3(0, 0, -3), vector3(0, 0, 0), vector3(0, 1, 0));
+    BenchmarkRays rays(camera, width, height);
+
+    Material material;
+    Sphere sphere(vector3(0, 0, 0), 0.8, material);
+    Triangle triangle(vector3(-1, -1, 0), vector3(1, -1, 0), vector3(0, 1, 0), material);
+    AABB box = sphere.get_bbox();
+
+    compare("Sphere::intersects", rays,
+        [&](const ray& r) { double t; return sphere.intersects(r, t); },
+        [&](const ray_packet<4>& r) { doublexN<4> t; return sphere.intersects(r, t, maskxN<4>(true)); },
+        [&](const ray_packet<8>& r) { doublexN<8> t; return sphere.intersects(r, t, maskxN<8>(true)); });
+
+    compare("Triangle::intersects", rays,
+        [&](const ray& r) { double t; return triangle.intersects(r, t); },
+        [&](const ray_packet<4>& r) { doublexN<4> t; return triangle.intersects(r, t, maskxN<4>(true)); },
+        [&](const ray_packet<8>& r) { doublexN<8> t; return triangle.intersects(r, t, maskxN<8>(true)); });
+
+    compare("AABB::intersects", rays,
+        [&](const ray& r) { return box.intersects(r); },
+        [&](const ray_packet<4>& r) { return box.intersects(r, maskxN<4>(true)); },
+        [&](const ray_packet<8>& r) { return box.intersects(r, maskxN<8>(true)); });
+}
+
+// Every kernel variant this CPU can run on the same packets and frame, checked against the generic one
+void benchmark_isa() {
+    const ISA selected = simd_kernels().isa;
+    std::cout << "Detected " << isa_name(detect_isa()) << ", running " << isa_name(selected) << "\n";
+
+    const int width = 64, height = 64;
+    Camera camera(width, height, 45.0, vector3(0, 0, -3), vector3(0, 0, 0), vector3(0, 1, 0));
+    std::vector<ray_packet<16>> packets;
+    for (int y = 0; y < height; y += 4) {
+        for (int x = 0; x < width; x += 4) {
+            doublexN<16> u, v;
+            for (int i = 0; i < 16; ++i) { u[i] = (x + i % 4 + 0.5) / width; v[i] = (y + i / 4 + 0.5) / height; }
+            packets.push_back(camera.get_ray(u, v));
+        }
+    }
+    const size_t num_rays = packets.size() * 16;
+
+    Material material;
+    Sphere sphere(vector3(0, 0, 0), 0.8, material);
+    Triangle triangle(vector3(-1, -1, 0), vector3(1, -1, 0), vector3(0, 1, 0), material);
+    AABB box = sphere.get_bbox();
+
+    // A 1080p frame with values from deep shadow to well over 1. No gamma, whose pow calls would take most
+    // of the time and are the same library call in every variant
+    const int frame_width = 1920, frame_height = 1080;
+    std::vector<vector3> frame(static_cast<size_t>(frame_width) * frame_height);
+    for (size_t i = 0; i < frame.size(); ++i) {
+        frame[i] = vector3(random_double(0.0, 4.0), random_double(0.0, 1.0), random_double(0.0, 0.05));
+    }
+    std::vector<unsigned char> rgb(frame.size() * 3), reference_rgb;
+    std::vector<double> sphere_t, reference_t;
+    const ToneMapOperator operators[] = { ToneMapOperator::None, ToneMapOperator::Exposure, ToneMapOperator::Reinhard, ToneMapOperator::ACES };
+    const char* operator_names[] = { "none", "exposure", "reinhard", "aces" };
+
+    for (ISA isa : { ISA::Generic, ISA::SSE4, ISA::AVX2, ISA::AVX512 }) {
+        if (!set_isa(isa)) {
+            std::cout << isa_name(isa) << ": not supported\n";
+            continue;
+        }
+        std::cout << isa_name(isa) << ":\n";
+
+        // Sphere t values (and the tone-mapped bytes below) must match the generic kernels bit for bit
+        sphere_t.clear();
+        for (const auto& r : packets) {
+            doublexN<16> t(-1.0);
+            sphere.intersects(r, t, maskxN<16>(true));
+            sphere_t.insert(sphere_t.end(), t.v, t.v + 16);
+        }
+        if (isa == ISA::Generic) reference_t = sphere_t;
+
+        auto report_rays = [&](const char* label, const std::function<long()>& body) {
+            long hits = 0;
+            double rate = time_rays(200, num_rays, body, hits);
+            std::cout << "  " << label << rate / 1e6 << " Mrays/s (" << hits << " hits)\n";
+        };
+        report_rays("sphere    ", [&]() {
+            long hits = 0;
+            for (const auto& r : packets) { doublexN<16> t; hits += sphere.intersects(r, t, maskxN<16>(true)).count(); }
+            return hits;
+        });
+        report_rays("triangle  ", [&]() {
+            long hits = 0;
+            for (const auto& r : packets) { doublexN<16> t; hits += triangle.intersects(r, t, maskxN<16>(true)).count(); }
+            return hits;
+        });
+        report_rays("aabb      ", [&]() {
+            long hits = 0;
+            for (const auto& r : packets) hits += box.intersects(r, maskxN<16>(true)).count();
+            return hits;
+        });
+
+        long mismatches = 0;
+        for (int k = 0; k < 4; ++k) {
+            ToneMapSettings settings;
+            settings.op = operators[k];
+            const int passes = 5;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int pass = 0; pass < passes; ++pass) {
+                tone_map_to_rgb8(frame.data(), frame.size(), settings, rgb.data());
+            }
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            std::cout << "  tone map " << operator_names[k] << " " << elapsed.count() / passes * 1000.0 << " ms\n";
+
+            if (isa == ISA::Generic) reference_rgb.insert(reference_rgb.end(), rgb.begin(), rgb.end());
+            for (size_t i = 0; i < rgb.size(); ++i) mismatches += rgb[i] != reference_rgb[k * rgb.size() + i];
+        }
+        for (size_t i = 0; i < sphere_t.size(); ++i) mismatches += sphere_t[i] != reference_t[i];
+        std::cout << "  " << mismatches << " values differ from generic\n";
+    }
+
+    set_isa(selected);
+}
+
+// Closest hit for every pixel with TILE x TILE packets; returns seconds and fills t/shape per pixel
+template <int TILE>
+static double trace_primary_packets(const Scene& scene, const Camera& camera, int width, int height,
+                                    std::vector<double>& t_hits, std::vector<const Shape*>& shapes, PacketStats& stats) {
+    const int N = TILE * TILE;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int ty = 0; ty < height; ty += TILE) {
+        for (int tx = 0; tx < width; tx += TILE) {
+            maskxN<N> active;
+            doublexN<N> u, v;
+            for (int i = 0; i < N; ++i) {
+                int x = std::min(tx + i % TILE, width - 1);
+                int y = std::min(ty + i / TILE, height - 1);
+                active.set(i, tx + i % TILE < width && ty + i / TILE < height);
+                std::tie(u[i], v[i]) = normalize_pixel(x, y, width, height);
+            }
+
+            doublexN<N> t;
+            const Shape* hit_shapes[N];
+            maskxN<N> hit = scene.intersects(camera.get_ray(u, v), active, t, hit_shapes, std::numeric_limits<double>::max(), stats);
+            for (int i = 0; i < N; ++i) {
+                if (!active[i]) continue;
+                int index = (ty + i / TILE) * width + tx + i % TILE;
+                t_hits[index] = hit[i] ? t[i] : -1.0;
+                shapes[index] = hit[i] ? hit_shapes[i] : nullptr;
+            }
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return elapsed.count();
+}
+
+void benchmark_primary_rays(const Scene& scene, const Camera& camera, int width, int height) {
+    const size_t num_pixels = static_cast<size_t>(width) * height;
+    std::vector<double> scalar_t(num_pixels);
+    std::vector<const Shape*> scalar_shapes(num_pixels);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            auto [u, v] = normalize_pixel(x, y, width, height);
+            double t;
+            std::shared_ptr<Shape> shape;
+            bool hit = scene.intersects(camera.get_ray(u, v), t, shape, std::numeric_limits<double>::max());
+            scalar_t[y * width + x] = hit ? t : -1.0;
+            scalar_shapes[y * width + x] = hit ? shape.get() : nullptr;
+        }
+    }
+    std::chrono::duration<double> scalar_time = std::chrono::high_resolution_clock::now() - start;
+
+    std::cout << "Primary rays (" << width << "x" << height << ", BVH " << (scene.use_bvh ? "on" : "off") << "):\n"
+              << "  scalar      " << scalar_time.count() * 1000.0 << " ms\n";
+
+    auto report = [&](const std::string& label, double seconds, const std::vector<double>& t_hits,
+                      const std::vector<const Shape*>& shapes, const PacketStats& stats) {
+        size_t mismatches = 0;
+        for (size_t i = 0; i < num_pixels; ++i) {
+            if (shapes[i] != scalar_shapes[i] || t_hits[i] != scalar_t[i]) ++mismatches;
+        }
+        std::cout << "  " << label << "  " << seconds * 1000.0 << " ms (x" << scalar_time.count() / seconds << "), "
+                  << stats.nodes_culled << "/" << stats.nodes_visited << " nodes culled, "
+                  << stats.scalar_fallbacks << " scalar fallbacks, "
+                  << mismatches << " hits differ from scalar\n";
+    };
+
+    std::vector<double> t_hits(num_pixels);
+    std::vector<const Shape*> shapes(num_pixels);
+
+    PacketStats stats4;
+    double time4 = trace_primary_packets<4>(scene, camera, width, height, t_hits, shapes, stats4);
+    report("packet 4x4", time4, t_hits, shapes, stats4);
+
+    PacketStats stats8;
+    double time8 = trace_primary_packets<8>(scene, camera, width, height, t_hits, shapes, stats8);
+    report("packet 8x8", time8, t_hits, shapes, stats8);
+}
+
+// Root-mean-square difference in 8-bit steps, with both images clamped to [0, 1] like the output
+static double rmse(const std::vector<vector3>& a, const std::vector<vector3>& b) {
+    auto clamp01 = [](double v) { return std::min(std::max(v, 0.0), 1.0); };
+    double sum = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        double dr = clamp01(a[i].x) - clamp01(b[i].x);
+        double dg = clamp01(a[i].y) - clamp01(b[i].y);
+        double db = clamp01(a[i].z) - clamp01(b[i].z);
+        sum += dr * dr + dg * dg + db * db;
+    }
+    return 255.0 * std::sqrt(sum / (3.0 * a.size()));
+}
+
+void benchmark_samplers(const Scene& scene, const Camera& camera, int width, int height, int nbounces) {
+    const int reference_samples = 1024;
+    const int sample_counts[] = { 1, 4, 16, 64 };
+    const SamplerType samplers[] = { SamplerType::Random, SamplerType::Stratified, SamplerType::Halton,
+                                     SamplerType::Sobol, SamplerType::BlueNoise };
+
+    std::vector<vector3> reference(width * height), image(width * height);
+    auto start = std::chrono::high_resolution_clock::now();
+    render_sampled(scene, camera, width, height, nbounces, SamplerType::Random, reference_samples, reference);
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    std::cout << "RMSE (8-bit steps) against a " << reference_samples << " spp random-sampler reference ("
+              << elapsed.count() << " s), " << width << "x" << height << ":\n";
+    std::cout << "  spp         ";
+    for (int spp : sample_counts) std::cout << "\t" << spp;
+    std::cout << "\n";
+
+    for (SamplerType type : samplers) {
+        std::string name = sampler_name(type);
+        std::cout << "  " << name << std::string(12 - name.size(), ' ');
+        for (int spp : sample_counts) {
+            render_sampled(scene, camera, width, height, nbounces, type, spp, image);
+            std::cout << "\t" << rmse(image, reference);
+        }
+        std::cout << "\n";
+    }
+}
+
+void benchmark_output(const Scene& scene, const Camera& camera, int width, int height, int nbounces) {
+    const ImageFormat formats[] = { ImageFormat::P3, ImageFormat::P6, ImageFormat::PFM, ImageFormat::HDR, ImageFormat::PNG,
+                                     ImageFormat::EXR };
+    const std::string filename = "benchmark_output.tmp";
+
+    std::vector<vector3> framebuffer(width * height);
+    render_sampled(scene, camera, width, height, nbounces, SamplerType::Random, 1, framebuffer);
+
+    std::cout << "Image output, " << width << "x" << height << " (encode + write):\n";
+    for (ImageFormat format : formats) {
+        auto start = std::chrono::high_resolution_clock::now();
+        bool written = write_image(filename, format, framebuffer, width, height, ToneMapSettings());
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        double megabytes = written ? file.tellg() / 1e6 : 0.0;
+        std::string name = image_format_name(format);
+        std::cout << "  " << name << std::string(5 - name.size(), ' ') << elapsed.count() * 1000.0 << " ms, "
+                  << megabytes << " MB" << (written ? "" : " (write failed)") << "\n";
+    }
+    std::remove(filename.c_str());
+}
@@ -0,0 +1,30 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+
+class Scene;
+class Camera;
+
+// Micro-benchmarks, run with `raytracer --benchmark <name> [args]`
+int run_benchmark(const std::string& name, int argc, char* argv[]);
+
+// Benchmarks on a loaded scene, run with `raytracer <scene.json> [flags] --benchmark <name>`
+int run_scene_benchmark(const std::string& name, const Scene& scene, const Camera& camera, int width, int height, int nbounces);
+
+// Scalar vs 4/8-lane packet throughput for sphere, triangle and AABB tests
+void benchmark_packets();
+
+// Packet intersection and tone-mapping throughput for every kernel variant the CPU supports (see cpu_dispatch.h)
+void benchmark_isa();
+
+// Primary-ray closest hits: scalar traversal vs 4x4 and 8x8 packet traversal
+void benchmark_primary_rays(const Scene& scene, const Camera& camera, int width, int height);
+
+// RMSE against a high-sample reference for every sampler at increasing sample counts
+void benchmark_samplers(const Scene& scene, const Camera& camera, int width, int height, int nbounces);
+
+// Renders one frame, then times encoding + writing it in every output format
+void benchmark_output(const Scene& scene, const Camera& camera, int width, int height, int nbounces);
+
+#endif
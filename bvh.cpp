@@ -1,5 +1,7 @@
 #include "bvh.h"
 #include "shape.h"
+#include "sphere.h"
+#include "triangle.h"
 #include <algorithm>
 #include <numeric>
 
@@ -115,13 +117,15 @@ BVHNode::BVHNode(std::shared_ptr<BVHNode> left, std::shared_ptr<BVHNode> right)
 /* --------------- Intersection tests --------------- */
 
 // Check if a ray intersects the BVH tree
-bool BVH::intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t) const {
+bool BVH::intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t, NodeCache* cache) const {
     // Start at root and recursively check for intersections
-    return intersects_node(r, t_hit, hit_shape, max_t, root);
+    return intersects_node(r, t_hit, hit_shape, max_t, root, cache);
 }
 
 // Recursively check for intersections with the BVH tree
-bool BVH::intersects_node(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t, const std::shared_ptr<BVHNode>& node) const {
+bool BVH::intersects_node(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t, const std::shared_ptr<BVHNode>& node, NodeCache* cache) const {
+    if (cache) cache->access(node.get());
+
     // Check if the ray intersects the bounding box
     if (!node->bbox.intersects(r)) return false;
 
@@ -144,8 +148,8 @@ bool BVH::intersects_node(const ray& r, double& t_hit, std::shared_ptr<Shape>& h
     double t_left = max_t, t_right = max_t;
     std::shared_ptr<Shape> shape_left = nullptr, shape_right = nullptr;
 
-    bool hit_left = intersects_node(r, t_left, shape_left, max_t, node->left);
-    bool hit_right = intersects_node(r, t_right, shape_right, max_t, node->right);
+    bool hit_left = intersects_node(r, t_left, shape_left, max_t, node->left, cache);
+    bool hit_right = intersects_node(r, t_right, shape_right, max_t, node->right, cache);
 
     // Determine the closest hit between left and right children
     if (hit_left && (!hit_right || t_left < t_right)) {
@@ -186,4 +190,124 @@ bool AABB::intersects(const ray& r) const {
     }
 
     return true;
-}
\ No newline at end of file
+}
+// Interval product [a_lo, a_hi] * [b_lo, b_hi]
+static void interval_mul(double a_lo, double a_hi, double b_lo, double b_hi, double& lo, double& hi) {
+    double p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+    lo = std::min({p0, p1, p2, p3});
+    hi = std::max({p0, p1, p2, p3});
+}
+
+// Interval version of the slab test: bounds the entry and exit distances of every ray in the packet
+bool AABB::misses(const PacketBounds& b) const {
+    double entry = -INFINITY, exit = INFINITY;
+
+    for (int i = 0; i < 3; ++i) {
+        // All rays share the direction sign on this axis, so they all enter through the same slab plane
+        bool positive = b.inv_dir_min[i] > 0.0;
+        double near_plane = positive ? min[i] : max[i];
+        double far_plane = positive ? max[i] : min[i];
+
+        double near_lo, near_hi, far_lo, far_hi;
+        interval_mul(near_plane - b.origin_max[i], near_plane - b.origin_min[i], b.inv_dir_min[i], b.inv_dir_max[i], near_lo, near_hi);
+        interval_mul(far_plane - b.origin_max[i], far_plane - b.origin_min[i], b.inv_dir_min[i], b.inv_dir_max[i], far_lo, far_hi);
+
+        entry = std::max(entry, near_lo);
+        exit = std::min(exit, far_hi);
+    }
+
+    return entry > exit;
+}
+
+/* --------------- Packet traversal --------------- */
+
+// A packet with fewer than 1/packet_fallback_divisor of its lanes active is traced ray by ray
+static const int packet_fallback_divisor = 4;
+
+template <int N>
+maskxN<N> BVH::intersects(const ray_packet<N>& r, const maskxN<N>& active, doublexN<N>& t_hit, const Shape* hit_shapes[], double max_t, PacketStats& stats) const {
+    t_hit = doublexN<N>(max_t);
+    for (int i = 0; i < N; ++i) hit_shapes[i] = nullptr;
+
+    stats.packets++;
+    intersects_node(r, PacketBounds(r, active), active, t_hit, hit_shapes, root, stats);
+
+    maskxN<N> hit;
+    for (int i = 0; i < N; ++i) hit.set(i, hit_shapes[i] != nullptr);
+    return hit;
+}
+
+template <int N>
+void BVH::intersects_node(const ray_packet<N>& r, const PacketBounds& bounds, const maskxN<N>& active, doublexN<N>& t_hit,
+                          const Shape* hit_shapes[], const std::shared_ptr<BVHNode>& node, PacketStats& stats) const {
+    stats.nodes_visited++;
+
+    // Reject the subtree for the whole packet before paying for the per-lane test
+    if (bounds.coherent && node->bbox.misses(bounds)) {
+        stats.nodes_culled++;
+        return;
+    }
+
+    maskxN<N> lanes = node->bbox.intersects(r, active);
+    int count = lanes.count();
+    if (count == 0) return;
+
+    // The packet has diverged: finish the few remaining rays with the scalar traversal
+    if (count * packet_fallback_divisor < N) {
+        for (int i = 0; i < N; ++i) {
+            if (!lanes[i]) continue;
+            double t = t_hit[i];
+            std::shared_ptr<Shape> shape;
+            if (intersects_node(r.get(i), t, shape, t_hit[i], node)) {
+                t_hit[i] = t;
+                hit_shapes[i] = shape.get();
+            }
+            stats.scalar_fallbacks++;
+        }
+        return;
+    }
+
+    if (node->is_leaf()) {
+        for (const auto& shape : node->primitives) {
+            doublexN<N> t = t_hit;
+            maskxN<N> hit = intersects_packet(*shape, r, t, lanes);
+            maskxN<N> closer = hit & (t < t_hit) & (t > doublexN<N>(1e-4));
+            t_hit = select(closer, t, t_hit);
+            for (int i = 0; i < N; ++i) {
+                if (closer[i]) hit_shapes[i] = shape.get();
+            }
+        }
+        return;
+    }
+
+    intersects_node(r, bounds, lanes, t_hit, hit_shapes, node->left, stats);
+    intersects_node(r, bounds, lanes, t_hit, hit_shapes, node->right, stats);
+}
+
+template <int N>
+maskxN<N> intersects_packet(const Shape& shape, const ray_packet<N>& r, doublexN<N>& t_hit, const maskxN<N>& active) {
+    switch (shape.get_type()) {
+        case ShapeType::Sphere:
+            return static_cast<const Sphere&>(shape).intersects(r, t_hit, active);
+        case ShapeType::Triangle:
+            return static_cast<const Triangle&>(shape).intersects(r, t_hit, active);
+        default: {
+            // No packet kernel for this shape: test lane by lane
+            maskxN<N> hit;
+            for (int i = 0; i < N; ++i) {
+                double t = 0;
+                if (active[i] && shape.intersects(r.get(i), t)) {
+                    t_hit[i] = t;
+                    hit.set(i, true);
+                }
+            }
+            return hit;
+        }
+    }
+}
+
+// Packet sizes used by the 4x4 and 8x8 tile tracers
+template maskxN<16> BVH::intersects<16>(const ray_packet<16>&, const maskxN<16>&, doublexN<16>&, const Shape*[], double, PacketStats&) const;
+template maskxN<64> BVH::intersects<64>(const ray_packet<64>&, const maskxN<64>&, doublexN<64>&, const Shape*[], double, PacketStats&) const;
+template maskxN<16> intersects_packet<16>(const Shape&, const ray_packet<16>&, doublexN<16>&, const maskxN<16>&);
+template maskxN<64> intersects_packet<64>(const Shape&, const ray_packet<64>&, doublexN<64>&, const maskxN<64>&);
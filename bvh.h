@@ -4,12 +4,94 @@
 #include "shape.h"
 #include "vector3.h"
 #include "ray.h"
+#include "cpu_dispatch.h"
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
 
 class Shape;
 
+// Interval bounds over the origins and reciprocal directions of a ray packet,
+// used to reject a node for the whole packet with a single test
+struct PacketBounds {
+    vector3 origin_min, origin_max;
+    vector3 inv_dir_min, inv_dir_max;
+    bool coherent = true; // false when direction signs differ on some axis
+
+    template <int N>
+    PacketBounds(const ray_packet<N>& r, const maskxN<N>& active) {
+        const doublexN<N>* o[3] = { &r.origin.x, &r.origin.y, &r.origin.z };
+        const doublexN<N>* inv[3] = { &r.inv_direction.x, &r.inv_direction.y, &r.inv_direction.z };
+        double o_lo[3], o_hi[3], inv_lo[3], inv_hi[3];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            o_lo[axis] = inv_lo[axis] = INFINITY;
+            o_hi[axis] = inv_hi[axis] = -INFINITY;
+            for (int i = 0; i < N; ++i) {
+                if (!active[i]) continue;
+                o_lo[axis] = std::min(o_lo[axis], (*o[axis])[i]);
+                o_hi[axis] = std::max(o_hi[axis], (*o[axis])[i]);
+                inv_lo[axis] = std::min(inv_lo[axis], (*inv[axis])[i]);
+                inv_hi[axis] = std::max(inv_hi[axis], (*inv[axis])[i]);
+            }
+            // Mixed signs or axis-parallel rays make the interval slab test meaningless
+            bool same_sign = inv_lo[axis] > 0.0 || inv_hi[axis] < 0.0;
+            if (!same_sign || std::isinf(inv_lo[axis]) || std::isinf(inv_hi[axis])) {
+                coherent = false;
+            }
+        }
+        origin_min = vector3(o_lo[0], o_lo[1], o_lo[2]);
+        origin_max = vector3(o_hi[0], o_hi[1], o_hi[2]);
+        inv_dir_min = vector3(inv_lo[0], inv_lo[1], inv_lo[2]);
+        inv_dir_max = vector3(inv_hi[0], inv_hi[1], inv_hi[2]);
+    }
+};
+
+// Counters gathered while tracing packets
+struct PacketStats {
+    long packets = 0;
+    long nodes_visited = 0;
+    long nodes_culled = 0;      // rejected for the whole packet by the interval test
+    long scalar_fallbacks = 0;  // lanes traced on their own after the packet diverged
+
+    void merge(const PacketStats& other) {
+        packets += other.packets;
+        nodes_visited += other.nodes_visited;
+        nodes_culled += other.nodes_culled;
+        scalar_fallbacks += other.scalar_fallbacks;
+    }
+};
+
+// Model of a set-associative LRU cache of BVH nodes (about the size of an L2 cache), used to measure
+// how often a ray's traversal touches nodes that the rays traced just before it also touched
+struct NodeCache {
+    static const int sets = 256;
+    static const int ways = 8;
+    static const int capacity = sets * ways;
+    const void* nodes[sets][ways] = {};   // per set, most recently used first
+    long accesses = 0;
+    long hits = 0;
+
+    void access(const void* node) {
+        accesses++;
+        const void** set = nodes[(reinterpret_cast<uintptr_t>(node) >> 6) % sets];
+        int i = 0;
+        while (i < ways - 1 && set[i] != node) ++i;
+        if (set[i] == node) hits++;
+        for (; i > 0; --i) set[i] = set[i - 1];
+        set[0] = node;
+    }
+
+    double hit_rate() const { return accesses ? static_cast<double>(hits) / accesses : 0.0; }
+
+    // Adds another cache's counts, e.g. one per thread; the cached nodes themselves stay apart
+    void merge(const NodeCache& other) {
+        accesses += other.accesses;
+        hits += other.hits;
+    }
+};
+
 // Axis-aligned bounding box (bounding volume)
 struct AABB {
     vector3 min, max;
@@ -42,6 +124,17 @@ struct AABB {
 
     // Check if a ray intersects this AABB
     bool intersects(const ray& r) const;
+
+    // True when no ray within the packet bounds can overlap the box
+    bool misses(const PacketBounds& bounds) const;
+
+    // Packet slab test: returns the active lanes whose ray overlaps the box (kernel in simd_kernels.inc)
+    template <int N>
+    maskxN<N> intersects(const ray_packet<N>& r, const maskxN<N>& active) const {
+        maskxN<N> hit;
+        packet_kernels<N>().aabb(*this, r, active, hit);
+        return hit;
+    }
 };
 
 
@@ -66,12 +159,25 @@ public:
 
     BVH(const std::vector<std::shared_ptr<Shape>>& shapes);
 
-    bool intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t) const;
+    // `cache`, when given, records every node the traversal visits
+    bool intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t, NodeCache* cache = nullptr) const;
+
+    bool intersects_node(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t, const std::shared_ptr<BVHNode>& node, NodeCache* cache = nullptr) const;
+
+    // Traces the active lanes of a packet together; hit_shapes[i] stays null for lanes that miss
+    template <int N>
+    maskxN<N> intersects(const ray_packet<N>& r, const maskxN<N>& active, doublexN<N>& t_hit, const Shape* hit_shapes[], double max_t, PacketStats& stats) const;
 
-    bool intersects_node(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t, const std::shared_ptr<BVHNode>& node) const;
-    
 private:
     std::shared_ptr<BVHNode> build_tree(const std::vector<std::shared_ptr<Shape>>& shapes);
+
+    template <int N>
+    void intersects_node(const ray_packet<N>& r, const PacketBounds& bounds, const maskxN<N>& active, doublexN<N>& t_hit,
+                         const Shape* hit_shapes[], const std::shared_ptr<BVHNode>& node, PacketStats& stats) const;
 };
 
+// Packet intersection with a single shape, using the SIMD kernel where the shape has one
+template <int N>
+maskxN<N> intersects_packet(const Shape& shape, const ray_packet<N>& r, doublexN<N>& t_hit, const maskxN<N>& active);
+
 #endif
@@ -31,6 +31,16 @@ public:
     ray get_ray(double u, double v) const {
         return ray(origin, upper_left_corner + horizontal * u - vertical * v - origin);
     }
+
+    // Generates N primary rays at once from per-lane (u, v) coordinates
+    template <int N>
+    ray_packet<N> get_ray(const doublexN<N>& u, const doublexN<N>& v) const {
+        vector3xN<N> dir;
+        for (int i = 0; i < N; ++i) {
+            dir.set(i, upper_left_corner + horizontal * u[i] - vertical * v[i] - origin);
+        }
+        return ray_packet<N>(vector3xN<N>(origin), dir);
+    }
 };
 
 #endif
\ No newline at end of file
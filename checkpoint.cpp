@@ -0,0 +1,132 @@
+#include "checkpoint.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout: header, then per pixel 3 colour sums, the luminance sum and the squared luminance sum
+// as doubles (kept at full precision so resuming is exact), and the int32 sample counts
+// Padded to 8 bytes so the doubles that follow it stay aligned
+struct alignas(8) CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t width, height;
+    int32_t passes;
+    int32_t nbounces;
+    int32_t sampler;
+    int32_t strata;
+};
+
+static const char checkpoint_magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0' };
+static const uint32_t checkpoint_version = 3;
+
+static size_t checkpoint_size(const CheckpointHeader& header) {
+    size_t pixels = static_cast<size_t>(header.width) * header.height;
+    return sizeof(CheckpointHeader) + pixels * 5 * sizeof(double) + pixels * sizeof(int32_t);
+}
+
+bool save_checkpoint(const std::string& path, const AccumulationBuffer& accum, const CheckpointInfo& info, std::string& error) {
+    CheckpointHeader header;
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.width = accum.width;
+    header.height = accum.height;
+    header.passes = accum.passes;
+    header.nbounces = info.nbounces;
+    header.sampler = static_cast<int32_t>(info.sampler);
+    header.strata = info.strata;
+    size_t size = checkpoint_size(header);
+
+    std::string temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error = "cannot create " + temp_path;
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        error = "cannot resize " + temp_path;
+        return false;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        error = "cannot map " + temp_path;
+        return false;
+    }
+
+    char* out = static_cast<char*>(mapping);
+    std::memcpy(out, &header, sizeof(header));
+    double* sums = reinterpret_cast<double*>(out + sizeof(header));
+    size_t pixels = accum.color_sum.size();
+    for (size_t i = 0; i < pixels; ++i) {
+        sums[5 * i + 0] = accum.color_sum[i].x;
+        sums[5 * i + 1] = accum.color_sum[i].y;
+        sums[5 * i + 2] = accum.color_sum[i].z;
+        sums[5 * i + 3] = accum.luminance_sum[i];
+        sums[5 * i + 4] = accum.luminance_sq_sum[i];
+    }
+    int32_t* samples = reinterpret_cast<int32_t*>(sums + 5 * pixels);
+    for (size_t i = 0; i < pixels; ++i) samples[i] = accum.samples[i];
+
+    bool synced = msync(mapping, size, MS_SYNC) == 0;
+    munmap(mapping, size);
+    if (!synced || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+bool load_checkpoint(const std::string& path, AccumulationBuffer& accum, CheckpointInfo& info, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open " + path;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CheckpointHeader)) {
+        close(fd);
+        error = path + " is not a checkpoint";
+        return false;
+    }
+    size_t size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        error = "cannot map " + path;
+        return false;
+    }
+
+    const char* in = static_cast<const char*>(mapping);
+    CheckpointHeader header;
+    std::memcpy(&header, in, sizeof(header));
+    if (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0 || header.version != checkpoint_version
+        || header.width <= 0 || header.height <= 0 || checkpoint_size(header) != size) {
+        munmap(mapping, size);
+        error = path + " is not a checkpoint";
+        return false;
+    }
+
+    accum.resize(header.width, header.height);
+    accum.passes = header.passes;
+    const double* sums = reinterpret_cast<const double*>(in + sizeof(header));
+    size_t pixels = accum.color_sum.size();
+    for (size_t i = 0; i < pixels; ++i) {
+        accum.color_sum[i] = vector3(sums[5 * i + 0], sums[5 * i + 1], sums[5 * i + 2]);
+        accum.luminance_sum[i] = sums[5 * i + 3];
+        accum.luminance_sq_sum[i] = sums[5 * i + 4];
+    }
+    const int32_t* samples = reinterpret_cast<const int32_t*>(sums + 5 * pixels);
+    for (size_t i = 0; i < pixels; ++i) accum.samples[i] = samples[i];
+    munmap(mapping, size);
+
+    info.nbounces = header.nbounces;
+    info.sampler = static_cast<SamplerType>(header.sampler);
+    info.strata = header.strata;
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include "progressive.h"
+#include "sampler.h"
+
+// What a checkpoint was rendered with; a resume must match it
+struct CheckpointInfo {
+    int nbounces = 0;
+    SamplerType sampler = SamplerType::Sobol;
+    int strata = 0; // samples_per_pixel the sampler was made with, the --progressive target
+};
+
+// Writes the accumulation buffer and its per-pixel sample counts through a memory-mapped `path`.tmp,
+// then renames it over `path`, so a crash mid-write leaves the previous checkpoint intact. Returns false
+// and fills `error` on failure
+bool save_checkpoint(const std::string& path, const AccumulationBuffer& accum, const CheckpointInfo& info, std::string& error);
+
+// Restores a checkpoint written by save_checkpoint. Every sampler derives its numbers from the pixel,
+// the sample index and the dimension, so no generator state is needed for the render to continue with
+// exactly the samples an uninterrupted run would have taken
+bool load_checkpoint(const std::string& path, AccumulationBuffer& accum, CheckpointInfo& info, std::string& error);
+
+#endif
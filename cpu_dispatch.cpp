@@ -0,0 +1,76 @@
+#include "cpu_dispatch.h"
+
+// One table per variant, defined by the kernels_<isa>.cpp files
+extern const SimdKernels generic_kernels;
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+extern const SimdKernels sse4_kernels;
+extern const SimdKernels avx2_kernels;
+extern const SimdKernels avx512_kernels;
+#endif
+
+bool parse_isa(const std::string& name, ISA& isa) {
+    if (name == "generic") isa = ISA::Generic;
+    else if (name == "sse4") isa = ISA::SSE4;
+    else if (name == "avx2") isa = ISA::AVX2;
+    else if (name == "avx512") isa = ISA::AVX512;
+    else return false;
+    return true;
+}
+
+const char* isa_name(ISA isa) {
+    switch (isa) {
+        case ISA::Generic: return "generic";
+        case ISA::SSE4: return "sse4";
+        case ISA::AVX2: return "avx2";
+        case ISA::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+bool isa_supported(ISA isa) {
+#ifdef HAVE_X86_KERNELS
+    // cpuid is read by the runtime; __builtin_cpu_init makes this safe from static initializers too
+    __builtin_cpu_init();
+    switch (isa) {
+        case ISA::Generic: return true;
+        case ISA::SSE4: return __builtin_cpu_supports("sse4.2");
+        case ISA::AVX2: return __builtin_cpu_supports("avx2");
+        case ISA::AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+    }
+    return false;
+#else
+    return isa == ISA::Generic;
+#endif
+}
+
+ISA detect_isa() {
+    for (ISA isa : { ISA::AVX512, ISA::AVX2, ISA::SSE4 }) {
+        if (isa_supported(isa)) return isa;
+    }
+    return ISA::Generic;
+}
+
+static const SimdKernels& kernels_for(ISA isa) {
+#ifdef HAVE_X86_KERNELS
+    switch (isa) {
+        case ISA::Generic: break;
+        case ISA::SSE4: return sse4_kernels;
+        case ISA::AVX2: return avx2_kernels;
+        case ISA::AVX512: return avx512_kernels;
+    }
+#endif
+    return generic_kernels;
+}
+
+// Static initializers in other files that run before the detection below get the generic kernels
+const SimdKernels* selected_kernels = &generic_kernels;
+
+bool set_isa(ISA isa) {
+    if (!isa_supported(isa)) return false;
+    selected_kernels = &kernels_for(isa);
+    return true;
+}
+
+[[maybe_unused]] static const bool isa_detected = set_isa(detect_isa());
@@ -0,0 +1,70 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <string>
+#include "vector3.h"
+#include "vector3_packet.h"
+#include "ray.h"
+
+struct AABB;
+class Sphere;
+class Triangle;
+struct ToneMapBlock;
+
+// Instruction sets the hot kernels are compiled for. The Makefile builds the default objects for plain
+// x86-64 (SSE2) so one binary runs everywhere; simd_kernels.inc is compiled once more per set with the
+// matching -m flags, and the widest one the CPU supports is picked once at startup
+enum class ISA {
+    Generic,  // the baseline the rest of the binary is built for
+    SSE4,     // SSE4.2: blends and rounding instructions
+    AVX2,     // 4 doubles per register
+    AVX512    // AVX-512 F/DQ/VL: 8 doubles per register and mask registers
+};
+
+// Parses "generic", "sse4", "avx2" or "avx512"; returns false for anything else
+bool parse_isa(const std::string& name, ISA& isa);
+
+const char* isa_name(ISA isa);
+
+// True when this CPU (and OS, for the wider register state) can run the variant, and it was built in
+bool isa_supported(ISA isa);
+
+// Widest supported variant
+ISA detect_isa();
+
+// Packet kernels for N lanes, see simd_kernels.inc. Results go to `hit` (and `t_hit` for the lanes that hit)
+template <int N>
+struct PacketKernels {
+    void (*aabb)(const AABB& box, const ray_packet<N>& r, const maskxN<N>& active, maskxN<N>& hit);
+    void (*sphere)(const Sphere& sphere, const ray_packet<N>& r, doublexN<N>& t_hit, const maskxN<N>& active, maskxN<N>& hit);
+    void (*triangle)(const Triangle& triangle, const ray_packet<N>& r, doublexN<N>& t_hit, const maskxN<N>& active, maskxN<N>& hit);
+};
+
+// One compiled variant of every dispatched kernel. The single-ray tests (AABB::intersects(const ray&),
+// Sphere::intersects, Triangle::intersects) are not in here: one ray is a chain of dependent scalar
+// operations that SSE2 already covers, so a wider instruction set has nothing to vectorize, and an
+// indirect call behind every slab test only made BVH traversal slower
+struct SimdKernels {
+    ISA isa;
+    PacketKernels<4> packet4;    // benchmark_packets
+    PacketKernels<8> packet8;
+    PacketKernels<16> packet16;  // 4x4 tiles and wavefront packets
+    PacketKernels<64> packet64;  // 8x8 tiles
+    void (*tone_map_block)(const vector3* pixels, int n, const ToneMapBlock& block, unsigned char* rgb);
+};
+
+// The variant in use; set to detect_isa() before main runs
+extern const SimdKernels* selected_kernels;
+
+inline const SimdKernels& simd_kernels() { return *selected_kernels; }
+
+// Switches every kernel to another variant (the --isa override); false if the CPU can't run it
+bool set_isa(ISA isa);
+
+template <int N> const PacketKernels<N>& packet_kernels();
+template <> inline const PacketKernels<4>& packet_kernels<4>() { return simd_kernels().packet4; }
+template <> inline const PacketKernels<8>& packet_kernels<8>() { return simd_kernels().packet8; }
+template <> inline const PacketKernels<16>& packet_kernels<16>() { return simd_kernels().packet16; }
+template <> inline const PacketKernels<64>& packet_kernels<64>() { return simd_kernels().packet64; }
+
+#endif
@@ -117,6 +117,8 @@ public:
         return {u, v};
     }
 
+    ShapeType get_type() const override { return ShapeType::Cylinder; }
+
     // Get bounding box for the cylinder
     AABB get_bbox() const override {
         AABB bbox;
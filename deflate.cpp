@@ -0,0 +1,363 @@
+#include "deflate.h"
+
+#include <algorithm>
+#include <queue>
+
+// Bits are packed least significant first, as deflate requires
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : out(out) {}
+
+    void write(uint32_t bits, int count) {
+        buffer |= static_cast<uint64_t>(bits) << used;
+        used += count;
+        while (used >= 8) {
+            out.push_back(static_cast<unsigned char>(buffer));
+            buffer >>= 8;
+            used -= 8;
+        }
+    }
+
+
+    void align() {
+        if (used > 0) write(0, 8 - used);
+    }
+
+private:
+    std::vector<unsigned char>& out;
+    uint64_t buffer = 0;
+    int used = 0;
+};
+
+static const int length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                     67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const int distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                       1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const int distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const int code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static int length_code(int length) {
+    static const std::vector<unsigned char> table = []() {
+        std::vector<unsigned char> t(259, 0);
+        for (int length = 3, code = 0; length <= 258; ++length) {
+            while (code < 28 && length_base[code + 1] <= length) code++;
+            t[length] = code;
+        }
+        return t;
+    }();
+    return table[length];
+}
+
+// Distances up to 256 index the table directly, longer ones by (distance - 1) >> 7 as in zlib
+static int distance_code(int distance) {
+    static const std::vector<unsigned char> table = []() {
+        std::vector<unsigned char> t(512, 0);
+        auto code_of = [](int distance) {
+            int code = 0;
+            while (code < 29 && distance_base[code + 1] <= distance) code++;
+            return code;
+        };
+        for (int d = 1; d <= 256; ++d) t[d - 1] = code_of(d);
+        for (int i = 2; i < 256; ++i) t[256 + i] = code_of((i << 7) + 1);
+        return t;
+    }();
+    return distance <= 256 ? table[distance - 1] : table[256 + ((distance - 1) >> 7)];
+}
+
+// Huffman code lengths for `freq`, limited to `max_bits` by flattening the frequencies until they fit.
+// At least two symbols always get a code so every tree is complete
+static std::vector<int> code_lengths(std::vector<uint32_t> freq, int max_bits) {
+    int used = std::count_if(freq.begin(), freq.end(), [](uint32_t f) { return f > 0; });
+    for (size_t i = 0; used < 2 && i < freq.size(); ++i) {
+        if (freq[i] == 0) { freq[i] = 1; used++; }
+    }
+
+    std::vector<int> lengths(freq.size(), 0);
+    while (true) {
+        // Nodes 0..n-1 are symbols, later ones internal; parent links give each symbol's depth
+        std::vector<int> parent(2 * freq.size(), -1);
+        using Node = std::pair<uint64_t, int>;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+        for (size_t i = 0; i < freq.size(); ++i) {
+            if (freq[i] > 0) heap.push({freq[i], static_cast<int>(i)});
+        }
+        int next = freq.size();
+        while (heap.size() > 1) {
+            Node a = heap.top(); heap.pop();
+            Node b = heap.top(); heap.pop();
+            parent[a.second] = parent[b.second] = next;
+            heap.push({a.first + b.first, next++});
+        }
+
+        int longest = 0;
+        for (size_t i = 0; i < freq.size(); ++i) {
+            lengths[i] = 0;
+            if (freq[i] == 0) continue;
+            for (int node = i; parent[node] >= 0; node = parent[node]) lengths[i]++;
+            longest = std::max(longest, lengths[i]);
+        }
+        if (longest <= max_bits) return lengths;
+        for (uint32_t& f : freq) {
+            if (f > 0) f = (f + 1) / 2;
+        }
+    }
+}
+
+// Canonical codes from code lengths (RFC 1951, 3.2.2), bit-reversed so they can go straight to the
+// least-significant-first BitWriter
+static std::vector<uint32_t> canonical_codes(const std::vector<int>& lengths) {
+    int bl_count[16] = {};
+    for (int l : lengths) bl_count[l]++;
+    bl_count[0] = 0;
+    uint32_t next_code[16] = {};
+    uint32_t code = 0;
+    for (int bits = 1; bits < 16; ++bits) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    std::vector<uint32_t> codes(lengths.size(), 0);
+    for (size_t i = 0; i < lengths.size(); ++i) {
+        if (!lengths[i]) continue;
+        uint32_t canonical = next_code[lengths[i]]++;
+        for (int bit = 0; bit < lengths[i]; ++bit) codes[i] |= ((canonical >> bit) & 1) << (lengths[i] - 1 - bit);
+    }
+    return codes;
+}
+
+// A literal (distance 0) or a match of `length` bytes `distance` back
+struct Symbol {
+    uint16_t length;
+    uint16_t distance;
+};
+
+// Run-length codes for the concatenated literal/length and distance code lengths (symbols 16-18)
+struct CodeLengthSymbol {
+    int symbol, extra;
+};
+
+static std::vector<CodeLengthSymbol> encode_code_lengths(const std::vector<int>& lengths) {
+    std::vector<CodeLengthSymbol> out;
+    for (size_t i = 0; i < lengths.size();) {
+        int value = lengths[i];
+        size_t run = 1;
+        while (i + run < lengths.size() && lengths[i + run] == value) run++;
+
+        if (value == 0 && run >= 3) {
+            int n = std::min<size_t>(run, 138);
+            out.push_back(n <= 10 ? CodeLengthSymbol{17, n - 3} : CodeLengthSymbol{18, n - 11});
+            i += n;
+        } else if (value != 0 && run >= 4) {
+            out.push_back({value, 0});
+            int n = std::min<size_t>(run - 1, 6);
+            out.push_back({16, n - 3});
+            i += 1 + n;
+        } else {
+            out.push_back({value, 0});
+            i++;
+        }
+    }
+    return out;
+}
+
+static void write_stored(BitWriter& bits, const unsigned char* data, size_t size, bool final) {
+    do {
+        size_t n = std::min<size_t>(size, 65535);
+        bits.write((final && n == size) ? 1 : 0, 1);
+        bits.write(0, 2);
+        bits.align();
+        bits.write(n & 0xffff, 16);
+        bits.write(~n & 0xffff, 16);
+        for (size_t i = 0; i < n; ++i) bits.write(data[i], 8);
+        data += n;
+        size -= n;
+    } while (size > 0);
+}
+
+// One block with dynamic Huffman codes, or stored if that turns out smaller
+static void write_block(BitWriter& bits, const std::vector<Symbol>& symbols, const unsigned char* raw, size_t raw_size, bool final) {
+    std::vector<uint32_t> lit_freq(286, 0), dist_freq(30, 0);
+    for (const Symbol& s : symbols) {
+        if (s.distance == 0) {
+            lit_freq[s.length]++;
+        } else {
+            lit_freq[257 + length_code(s.length)]++;
+            dist_freq[distance_code(s.distance)]++;
+        }
+    }
+    lit_freq[256] = 1; // end of block
+
+    std::vector<int> lit_lengths = code_lengths(lit_freq, 15);
+    std::vector<int> dist_lengths = code_lengths(dist_freq, 15);
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && lit_lengths[hlit - 1] == 0) hlit--;
+    while (hdist > 1 && dist_lengths[hdist - 1] == 0) hdist--;
+
+    std::vector<int> all_lengths(lit_lengths.begin(), lit_lengths.begin() + hlit);
+    all_lengths.insert(all_lengths.end(), dist_lengths.begin(), dist_lengths.begin() + hdist);
+    std::vector<CodeLengthSymbol> cl_symbols = encode_code_lengths(all_lengths);
+    std::vector<uint32_t> cl_freq(19, 0);
+    for (const CodeLengthSymbol& s : cl_symbols) cl_freq[s.symbol]++;
+    std::vector<int> cl_lengths = code_lengths(cl_freq, 7);
+    int hclen = 19;
+    while (hclen > 4 && cl_lengths[code_length_order[hclen - 1]] == 0) hclen--;
+
+    // Size in bits, to fall back to a stored block for incompressible data
+    static const int cl_extra[19] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+    size_t dynamic_bits = 3 + 14 + 3 * hclen;
+    for (const CodeLengthSymbol& s : cl_symbols) dynamic_bits += cl_lengths[s.symbol] + cl_extra[s.symbol];
+    for (int i = 0; i < 286; ++i) {
+        dynamic_bits += static_cast<size_t>(lit_freq[i]) * (lit_lengths[i] + (i > 256 ? length_extra[i - 257] : 0));
+    }
+    for (int i = 0; i < 30; ++i) dynamic_bits += static_cast<size_t>(dist_freq[i]) * (dist_lengths[i] + distance_extra[i]);
+    size_t stored_bits = (raw_size + 5 * (raw_size / 65535 + 1)) * 8 + 7;
+    if (stored_bits < dynamic_bits) {
+        write_stored(bits, raw, raw_size, final);
+        return;
+    }
+
+    std::vector<uint32_t> lit_codes = canonical_codes(lit_lengths);
+    std::vector<uint32_t> dist_codes = canonical_codes(dist_lengths);
+    std::vector<uint32_t> cl_codes = canonical_codes(cl_lengths);
+
+    bits.write(final ? 1 : 0, 1);
+    bits.write(2, 2); // dynamic Huffman
+    bits.write(hlit - 257, 5);
+    bits.write(hdist - 1, 5);
+    bits.write(hclen - 4, 4);
+    for (int i = 0; i < hclen; ++i) bits.write(cl_lengths[code_length_order[i]], 3);
+    for (const CodeLengthSymbol& s : cl_symbols) {
+        bits.write(cl_codes[s.symbol], cl_lengths[s.symbol]);
+        if (cl_extra[s.symbol]) bits.write(s.extra, cl_extra[s.symbol]);
+    }
+
+    for (const Symbol& s : symbols) {
+        if (s.distance == 0) {
+            bits.write(lit_codes[s.length], lit_lengths[s.length]);
+            continue;
+        }
+        int lc = length_code(s.length);
+        bits.write(lit_codes[257 + lc], lit_lengths[257 + lc]);
+        if (length_extra[lc]) bits.write(s.length - length_base[lc], length_extra[lc]);
+        int dc = distance_code(s.distance);
+        bits.write(dist_codes[dc], dist_lengths[dc]);
+        if (distance_extra[dc]) bits.write(s.distance - distance_base[dc], distance_extra[dc]);
+    }
+    bits.write(lit_codes[256], lit_lengths[256]);
+}
+
+std::vector<unsigned char> deflate_piece(const unsigned char* data, size_t size, bool last) {
+    const int window = 1 << 15, hash_bits = 15, max_chain = 32, max_match = 258;
+    const size_t block_symbols = 1 << 16;
+
+    std::vector<unsigned char> out;
+    out.reserve(size / 2 + 64);
+    BitWriter bits(out);
+
+    // Greedy LZ77 over hash chains of 3-byte prefixes
+    std::vector<int> head(1 << hash_bits, -1), prev(window, -1);
+    auto hash = [&](size_t i) {
+        uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return (v * 2654435761u) >> (32 - hash_bits);
+    };
+    auto insert = [&](size_t i) {
+        if (i + 2 >= size) return;
+        uint32_t h = hash(i);
+        prev[i & (window - 1)] = head[h];
+        head[h] = i;
+    };
+
+    std::vector<Symbol> symbols;
+    symbols.reserve(block_symbols);
+    size_t block_start = 0;
+    for (size_t i = 0; i < size;) {
+        int best_length = 0, best_distance = 0;
+        if (i + 2 < size) {
+            int limit = static_cast<int>(std::min<size_t>(max_match, size - i));
+            int chain = max_chain;
+            for (int candidate = head[hash(i)]; candidate >= 0 && chain-- > 0; candidate = prev[candidate & (window - 1)]) {
+                int distance = static_cast<int>(i - candidate);
+                if (distance > window - 1) break;
+                if (data[candidate + best_length] != data[i + best_length]) continue;
+                int length = 0;
+                while (length < limit && data[candidate + length] == data[i + length]) length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = distance;
+                    if (length == limit) break;
+                }
+            }
+        }
+
+        if (best_length >= 3) {
+            symbols.push_back({static_cast<uint16_t>(best_length), static_cast<uint16_t>(best_distance)});
+            for (int k = 0; k < best_length; ++k) insert(i + k);
+            i += best_length;
+        } else {
+            symbols.push_back({data[i], 0});
+            insert(i);
+            i++;
+        }
+
+        if (symbols.size() >= block_symbols) {
+            write_block(bits, symbols, data + block_start, i - block_start, last && i == size);
+            symbols.clear();
+            block_start = i;
+        }
+    }
+    if (!symbols.empty() || (last && block_start == 0)) {
+        write_block(bits, symbols, data + block_start, size - block_start, last);
+    }
+
+    if (!last) {
+        write_stored(bits, nullptr, 0, false); // sync point, so the next piece starts on a byte
+    }
+    bits.align();
+    return out;
+}
+
+uint32_t adler32(const unsigned char* data, size_t size, uint32_t adler) {
+    const uint32_t base = 65521;
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (size > 0) {
+        size_t n = std::min<size_t>(size, 5552); // largest run before b can overflow
+        for (size_t i = 0; i < n; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= base;
+        b %= base;
+        data += n;
+        size -= n;
+    }
+    return a | (b << 16);
+}
+
+uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size) {
+    const uint32_t base = 65521;
+    uint32_t rem = second_size % base;
+    uint32_t a = first & 0xffff;
+    uint32_t b = static_cast<uint32_t>((static_cast<uint64_t>(rem) * a) % base);
+    a += (second & 0xffff) + base - 1;
+    b += (first >> 16) + (second >> 16) + base - rem;
+    if (a >= base) a -= base;
+    if (a >= base) a -= base;
+    if (b >= 2 * base) b -= 2 * base;
+    if (b >= base) b -= base;
+    return a | (b << 16);
+}
+
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc) {
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
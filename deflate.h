@@ -0,0 +1,21 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Raw deflate (RFC 1951) of one piece of a larger stream, with no back-references into earlier
+// pieces, so pieces can be compressed independently and concatenated. Every piece but the last
+// ends with an empty non-final stored block (a byte-aligned sync point); the last piece ends
+// with the final block
+std::vector<unsigned char> deflate_piece(const unsigned char* data, size_t size, bool last);
+
+uint32_t adler32(const unsigned char* data, size_t size, uint32_t adler = 1);
+
+// Adler-32 of the concatenation of two buffers from their checksums and the second's length
+uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size);
+
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0);
+
+#endif
@@ -0,0 +1,688 @@
+#include "image_output.h"
+#include "deflate.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool parse_image_format(const std::string& name, ImageFormat& format) {
+    if (name == "p3") format = ImageFormat::P3;
+    else if (name == "p6" || name == "ppm") format = ImageFormat::P6;
+    else if (name == "pfm") format = ImageFormat::PFM;
+    else if (name == "hdr") format = ImageFormat::HDR;
+    else if (name == "png") format = ImageFormat::PNG;
+    else if (name == "exr") format = ImageFormat::EXR;
+    else return false;
+    return true;
+}
+
+ImageFormat image_format_for(const std::string& filename) {
+    auto ends_with = [&](const char* suffix) {
+        size_t n = std::strlen(suffix);
+        return filename.size() >= n && filename.compare(filename.size() - n, n, suffix) == 0;
+    };
+    if (ends_with(".pfm")) return ImageFormat::PFM;
+    if (ends_with(".hdr")) return ImageFormat::HDR;
+    if (ends_with(".png")) return ImageFormat::PNG;
+    if (ends_with(".exr")) return ImageFormat::EXR;
+    return ImageFormat::P6;
+}
+
+const char* image_format_name(ImageFormat format) {
+    switch (format) {
+        case ImageFormat::P3: return "p3";
+        case ImageFormat::P6: return "p6";
+        case ImageFormat::PFM: return "pfm";
+        case ImageFormat::HDR: return "hdr";
+        case ImageFormat::PNG: return "png";
+        case ImageFormat::EXR: return "exr";
+    }
+    return "?";
+}
+
+static void append(std::vector<unsigned char>& out, const std::string& text) {
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+static void encode_ppm(std::vector<unsigned char>& out, bool binary, const std::vector<vector3>& framebuffer, int width, int height,
+                       const ToneMapSettings& tone_mapping) {
+    append(out, std::string(binary ? "P6\n" : "P3\n") + std::to_string(width) + " " + std::to_string(height) + "\n255\n");
+    out.reserve(out.size() + framebuffer.size() * (binary ? 3 : 12));
+
+    if (binary) {
+        size_t header = out.size();
+        out.resize(header + framebuffer.size() * 3);
+        tone_map_to_rgb8(framebuffer.data(), framebuffer.size(), tone_mapping, out.data() + header);
+        return;
+    }
+
+    std::vector<unsigned char> rgb(framebuffer.size() * 3);
+    tone_map_to_rgb8(framebuffer.data(), framebuffer.size(), tone_mapping, rgb.data());
+    for (size_t i = 0; i < rgb.size(); ++i) {
+        char digits[4];
+        int n = 0, v = rgb[i];
+        do { digits[n++] = '0' + v % 10; v /= 10; } while (v);
+        while (n) out.push_back(digits[--n]);
+        out.push_back(i % 3 < 2 ? ' ' : '\n');
+    }
+}
+
+// Scale -1 marks little-endian data; rows are stored bottom to top
+static void encode_pfm(std::vector<unsigned char>& out, const std::vector<vector3>& framebuffer, int width, int height) {
+    append(out, "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n");
+    size_t header = out.size();
+    out.resize(header + framebuffer.size() * 3 * sizeof(float));
+
+    float* data = reinterpret_cast<float*>(out.data() + header);
+    for (int y = 0; y < height; ++y) {
+        const vector3* row = &framebuffer[static_cast<size_t>(height - 1 - y) * width];
+        for (int x = 0; x < width; ++x) {
+            *data++ = static_cast<float>(row[x].x);
+            *data++ = static_cast<float>(row[x].y);
+            *data++ = static_cast<float>(row[x].z);
+        }
+    }
+}
+
+// Shared-exponent RGBE; negative components are clamped to 0
+static void to_rgbe(const vector3& colour, unsigned char rgbe[4]) {
+    double r = std::max(colour.x, 0.0), g = std::max(colour.y, 0.0), b = std::max(colour.z, 0.0);
+    double v = std::max(r, std::max(g, b));
+    if (!(v >= 1e-32)) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return;
+    }
+    int exponent;
+    double scale = std::frexp(v, &exponent) * 256.0 / v;
+    rgbe[0] = static_cast<unsigned char>(r * scale);
+    rgbe[1] = static_cast<unsigned char>(g * scale);
+    rgbe[2] = static_cast<unsigned char>(b * scale);
+    rgbe[3] = static_cast<unsigned char>(exponent + 128);
+}
+
+// One channel of a scanline in the Radiance run-length scheme: a count byte above 128 is a run of
+// count - 128 copies of the next byte, otherwise count literal bytes follow
+static void encode_rle_channel(std::vector<unsigned char>& out, const unsigned char* values, int count) {
+    const int min_run = 4; // shorter runs are cheaper as literals
+    int i = 0;
+    while (i < count) {
+        // Find the next run long enough to encode as one
+        int run_start = i, run_length = 0;
+        while (run_start < count) {
+            run_length = 1;
+            while (run_start + run_length < count && run_length < 127 && values[run_start + run_length] == values[run_start]) {
+                run_length++;
+            }
+            if (run_length >= min_run) break;
+            run_start += run_length;
+        }
+        if (run_start >= count) run_length = 0;
+
+        // Literals up to the run
+        while (i < run_start) {
+            int n = std::min(128, run_start - i);
+            out.push_back(static_cast<unsigned char>(n));
+            out.insert(out.end(), values + i, values + i + n);
+            i += n;
+        }
+        if (run_length >= min_run) {
+            out.push_back(static_cast<unsigned char>(128 + run_length));
+            out.push_back(values[run_start]);
+            i += run_length;
+        }
+    }
+}
+
+static void encode_hdr(std::vector<unsigned char>& out, const std::vector<vector3>& framebuffer, int width, int height) {
+    append(out, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " + std::to_string(height) + " +X " + std::to_string(width) + "\n");
+    out.reserve(out.size() + framebuffer.size() * 4);
+
+    // Run-length encoding is only defined for widths in [8, 32767]; other images are stored flat
+    bool rle = width >= 8 && width < 32768;
+    std::vector<unsigned char> channels(4 * width);
+    for (int y = 0; y < height; ++y) {
+        const vector3* row = &framebuffer[static_cast<size_t>(y) * width];
+        if (!rle) {
+            for (int x = 0; x < width; ++x) {
+                unsigned char rgbe[4];
+                to_rgbe(row[x], rgbe);
+                out.insert(out.end(), rgbe, rgbe + 4);
+            }
+            continue;
+        }
+
+        for (int x = 0; x < width; ++x) {
+            unsigned char rgbe[4];
+            to_rgbe(row[x], rgbe);
+            for (int c = 0; c < 4; ++c) channels[c * width + x] = rgbe[c];
+        }
+        unsigned char marker[4] = { 2, 2, static_cast<unsigned char>(width >> 8), static_cast<unsigned char>(width & 0xff) };
+        out.insert(out.end(), marker, marker + 4);
+        for (int c = 0; c < 4; ++c) {
+            encode_rle_channel(out, &channels[c * width], width);
+        }
+    }
+}
+
+static void append_be32(std::vector<unsigned char>& out, uint32_t value) {
+    unsigned char bytes[4] = { static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+                               static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value) };
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+static void append_png_chunk(std::vector<unsigned char>& out, const char type[4], const unsigned char* data, size_t size) {
+    append_be32(out, size);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    append_be32(out, crc32(out.data() + start, out.size() - start));
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Residuals of one PNG filter over a row, into `out`; returns the sum of their absolute (signed) values.
+// `above` is a row of zeros for the first image row
+template <int Filter>
+static long filter_residuals(const unsigned char* row, const unsigned char* above, int row_bytes, unsigned char* out) {
+    const int bpp = 3;
+    long cost = 0;
+    for (int i = 0; i < row_bytes; ++i) {
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = above[i];
+        int c = i >= bpp ? above[i - bpp] : 0;
+        int predicted;
+        if constexpr (Filter == 0) predicted = 0;
+        else if constexpr (Filter == 1) predicted = a;
+        else if constexpr (Filter == 2) predicted = b;
+        else if constexpr (Filter == 3) predicted = (a + b) / 2;
+        else predicted = paeth(a, b, c);
+        unsigned char residual = static_cast<unsigned char>(row[i] - predicted);
+        out[i] = residual;
+        cost += residual < 128 ? residual : 256 - residual;
+    }
+    return cost;
+}
+
+// Tries all five PNG filters on a row and keeps the one with the smallest sum of absolute residuals,
+// the usual heuristic. `out` receives the filter byte and the row; `scratch` holds the candidate
+static void filter_row(const unsigned char* row, const unsigned char* above, int row_bytes, unsigned char* out,
+                       std::vector<unsigned char>& scratch) {
+    using FilterFunction = long (*)(const unsigned char*, const unsigned char*, int, unsigned char*);
+    static const FilterFunction filters[5] = { filter_residuals<0>, filter_residuals<1>, filter_residuals<2>,
+                                               filter_residuals<3>, filter_residuals<4> };
+    scratch.resize(row_bytes);
+    out[0] = 0;
+    long best_cost = filters[0](row, above, row_bytes, out + 1);
+    for (int filter = 1; filter < 5; ++filter) {
+        long cost = filters[filter](row, above, row_bytes, scratch.data());
+        if (cost < best_cost) {
+            best_cost = cost;
+            out[0] = static_cast<unsigned char>(filter);
+            std::copy(scratch.begin(), scratch.end(), out + 1);
+        }
+    }
+}
+
+// Rows are split into strips that are filtered and deflated independently and in parallel; the raw
+// deflate pieces concatenate into one zlib stream whose Adler-32 is combined per strip
+static void encode_png(std::vector<unsigned char>& out, const std::vector<vector3>& framebuffer, int width, int height,
+                       const ToneMapSettings& tone_mapping) {
+    const int row_bytes = 3 * width;
+    std::vector<unsigned char> rgb(static_cast<size_t>(row_bytes) * height);
+    tone_map_to_rgb8(framebuffer.data(), framebuffer.size(), tone_mapping, rgb.data());
+
+    // About 256 KB of filtered data per strip keeps the compression loss from the restarts negligible
+    const int strip_rows = std::max(1, (1 << 18) / (row_bytes + 1));
+    const int strips = (height + strip_rows - 1) / strip_rows;
+    std::vector<std::vector<unsigned char>> compressed(strips);
+    std::vector<uint32_t> checksums(strips);
+    std::vector<size_t> filtered_sizes(strips);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < strips; ++s) {
+        int y0 = s * strip_rows, y1 = std::min(height, y0 + strip_rows);
+        std::vector<unsigned char> filtered(static_cast<size_t>(y1 - y0) * (row_bytes + 1));
+        std::vector<unsigned char> zero_row(row_bytes, 0), scratch;
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char* row = &rgb[static_cast<size_t>(y) * row_bytes];
+            filter_row(row, y > 0 ? row - row_bytes : zero_row.data(), row_bytes,
+                       &filtered[static_cast<size_t>(y - y0) * (row_bytes + 1)], scratch);
+        }
+        compressed[s] = deflate_piece(filtered.data(), filtered.size(), s == strips - 1);
+        checksums[s] = adler32(filtered.data(), filtered.size());
+        filtered_sizes[s] = filtered.size();
+    }
+
+    std::vector<unsigned char> zlib = { 0x78, 0x01 }; // 32K window, no preset dictionary
+    uint32_t adler = 1;
+    for (int s = 0; s < strips; ++s) {
+        zlib.insert(zlib.end(), compressed[s].begin(), compressed[s].end());
+        adler = adler32_combine(adler, checksums[s], filtered_sizes[s]);
+    }
+    append_be32(zlib, adler);
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.insert(out.end(), signature, signature + 8);
+    std::vector<unsigned char> header;
+    append_be32(header, width);
+    append_be32(header, height);
+    unsigned char ihdr_tail[5] = { 8, 2, 0, 0, 0 }; // 8-bit RGB, deflate, adaptive filtering, no interlace
+    header.insert(header.end(), ihdr_tail, ihdr_tail + 5);
+    out.reserve(zlib.size() + 64);
+    append_png_chunk(out, "IHDR", header.data(), header.size());
+    append_png_chunk(out, "IDAT", zlib.data(), zlib.size());
+    append_png_chunk(out, "IEND", nullptr, 0);
+}
+
+// Nearest half float, ties to even; out-of-range values become infinity
+static uint16_t to_half(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent == 0xff) return sign | 0x7c00 | (mantissa ? 0x200 : 0); // infinity or NaN
+
+    int e = static_cast<int>(exponent) - 127 + 15;
+    if (e >= 31) return sign | 0x7c00;
+    if (e <= 0) {
+        // Subnormal half: the implicit bit becomes explicit and is shifted down
+        if (e < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - e;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) half++;
+        return sign | half;
+    }
+
+    uint32_t half = sign | (e << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++; // a carry rounds into the exponent
+    return half;
+}
+
+template <typename T>
+static void append_le(std::vector<unsigned char>& out, T value) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T)); // OpenEXR is little-endian, as are the hosts we build for
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void append_exr_attribute(std::vector<unsigned char>& out, const char* name, const char* type,
+                                 const std::vector<unsigned char>& value) {
+    out.insert(out.end(), name, name + std::strlen(name) + 1);
+    out.insert(out.end(), type, type + std::strlen(type) + 1);
+    append_le<int32_t>(out, value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// ZIP_COMPRESSION as OpenEXR defines it: bytes split into even and odd halves, delta-coded, then zlib.
+// A chunk that does not shrink is stored as is
+static std::vector<unsigned char> compress_exr_chunk(const std::vector<unsigned char>& raw) {
+    std::vector<unsigned char> predicted(raw.size());
+    size_t half = (raw.size() + 1) / 2;
+    for (size_t i = 0; i < raw.size(); ++i) {
+        predicted[(i & 1) ? half + i / 2 : i / 2] = raw[i];
+    }
+    for (size_t i = predicted.size(); i-- > 1;) {
+        predicted[i] = static_cast<unsigned char>(predicted[i] - predicted[i - 1] + 128);
+    }
+
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    std::vector<unsigned char> deflated = deflate_piece(predicted.data(), predicted.size(), true);
+    zlib.insert(zlib.end(), deflated.begin(), deflated.end());
+    append_be32(zlib, adler32(predicted.data(), predicted.size()));
+    return zlib.size() < raw.size() ? zlib : raw;
+}
+
+std::vector<unsigned char> encode_exr(const std::vector<ImageChannel>& channels, int width, int height) {
+    // The channel list and the data inside each scanline are sorted by name
+    std::vector<const ImageChannel*> sorted;
+    for (const ImageChannel& channel : channels) sorted.push_back(&channel);
+    std::sort(sorted.begin(), sorted.end(), [](const ImageChannel* a, const ImageChannel* b) { return a->name < b->name; });
+
+    std::vector<unsigned char> out = { 0x76, 0x2f, 0x31, 0x01 };
+    append_le<int32_t>(out, 2); // version 2, single-part scanline
+
+    std::vector<unsigned char> value;
+    for (const ImageChannel* channel : sorted) {
+        value.insert(value.end(), channel->name.begin(), channel->name.end());
+        value.push_back(0);
+        append_le<int32_t>(value, 1); // HALF
+        append_le<int32_t>(value, 0); // pLinear + reserved
+        append_le<int32_t>(value, 1); // x sampling
+        append_le<int32_t>(value, 1); // y sampling
+    }
+    value.push_back(0);
+    append_exr_attribute(out, "channels", "chlist", value);
+    append_exr_attribute(out, "compression", "compression", { 3 }); // ZIP, 16 scanlines per chunk
+
+    value.clear();
+    for (int32_t v : { 0, 0, width - 1, height - 1 }) append_le(value, v);
+    append_exr_attribute(out, "dataWindow", "box2i", value);
+    append_exr_attribute(out, "displayWindow", "box2i", value);
+    append_exr_attribute(out, "lineOrder", "lineOrder", { 0 }); // increasing y
+
+    value.clear();
+    append_le<float>(value, 1.0f);
+    append_exr_attribute(out, "pixelAspectRatio", "float", value);
+    append_exr_attribute(out, "screenWindowWidth", "float", value);
+    value.clear();
+    append_le<float>(value, 0.0f);
+    append_le<float>(value, 0.0f);
+    append_exr_attribute(out, "screenWindowCenter", "v2f", value);
+    out.push_back(0); // end of header
+
+    const int lines_per_chunk = 16;
+    const int chunks = (height + lines_per_chunk - 1) / lines_per_chunk;
+    std::vector<std::vector<unsigned char>> compressed(chunks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < chunks; ++c) {
+        int y0 = c * lines_per_chunk, y1 = std::min(height, y0 + lines_per_chunk);
+        std::vector<unsigned char> raw(static_cast<size_t>(y1 - y0) * width * sorted.size() * 2);
+        unsigned char* p = raw.data();
+        for (int y = y0; y < y1; ++y) {
+            for (const ImageChannel* channel : sorted) {
+                const float* row = &channel->values[static_cast<size_t>(y) * width];
+                for (int x = 0; x < width; ++x) {
+                    uint16_t half = to_half(row[x]);
+                    *p++ = half & 0xff;
+                    *p++ = half >> 8;
+                }
+            }
+        }
+        compressed[c] = compress_exr_chunk(raw);
+    }
+
+    // Offset table, then each chunk as (first line, size, data)
+    uint64_t offset = out.size() + chunks * sizeof(uint64_t);
+    for (int c = 0; c < chunks; ++c) {
+        append_le<uint64_t>(out, offset);
+        offset += 2 * sizeof(int32_t) + compressed[c].size();
+    }
+    for (int c = 0; c < chunks; ++c) {
+        append_le<int32_t>(out, c * lines_per_chunk);
+        append_le<int32_t>(out, compressed[c].size());
+        out.insert(out.end(), compressed[c].begin(), compressed[c].end());
+    }
+    return out;
+}
+
+static void encode_rgb_exr(std::vector<unsigned char>& out, const std::vector<vector3>& framebuffer, int width, int height) {
+    std::vector<ImageChannel> channels = { {"R", {}}, {"G", {}}, {"B", {}} };
+    for (ImageChannel& channel : channels) channel.values.reserve(framebuffer.size());
+    for (const vector3& pixel : framebuffer) {
+        channels[0].values.push_back(pixel.x);
+        channels[1].values.push_back(pixel.y);
+        channels[2].values.push_back(pixel.z);
+    }
+    out = encode_exr(channels, width, height);
+}
+
+std::vector<unsigned char> encode_image(ImageFormat format, const std::vector<vector3>& framebuffer, int width, int height,
+                                        const ToneMapSettings& tone_mapping) {
+    std::vector<unsigned char> out;
+    switch (format) {
+        case ImageFormat::P3: encode_ppm(out, false, framebuffer, width, height, tone_mapping); break;
+        case ImageFormat::P6: encode_ppm(out, true, framebuffer, width, height, tone_mapping); break;
+        case ImageFormat::PFM: encode_pfm(out, framebuffer, width, height); break;
+        case ImageFormat::HDR: encode_hdr(out, framebuffer, width, height); break;
+        case ImageFormat::PNG: encode_png(out, framebuffer, width, height, tone_mapping); break;
+        case ImageFormat::EXR: encode_rgb_exr(out, framebuffer, width, height); break;
+    }
+    return out;
+}
+
+static bool write_file(const std::string& filename, const std::vector<unsigned char>& data) {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) return false;
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return static_cast<bool>(out);
+}
+
+bool write_exr(const std::string& filename, const std::vector<ImageChannel>& channels, int width, int height) {
+    return write_file(filename, encode_exr(channels, width, height));
+}
+
+bool write_image(const std::string& filename, ImageFormat format, const std::vector<vector3>& framebuffer, int width, int height,
+                 const ToneMapSettings& tone_mapping) {
+    return write_file(filename, encode_image(format, framebuffer, width, height, tone_mapping));
+}
+
+// Reads the next whitespace-delimited token of a text header
+static std::string next_token(const std::vector<unsigned char>& data, size_t& pos) {
+    while (pos < data.size() && std::isspace(data[pos])) pos++;
+    size_t start = pos;
+    while (pos < data.size() && !std::isspace(data[pos])) pos++;
+    return std::string(data.begin() + start, data.begin() + pos);
+}
+
+// "PF" (RGB) or "Pf" (greyscale), width, height, then a scale whose sign gives the byte order; rows
+// bottom to top
+static bool decode_pfm(const std::vector<unsigned char>& data, std::vector<vector3>& framebuffer, int& width, int& height, std::string& error) {
+    size_t pos = 0;
+    std::string magic = next_token(data, pos);
+    int channels = magic == "PF" ? 3 : magic == "Pf" ? 1 : 0;
+    width = std::atoi(next_token(data, pos).c_str());
+    height = std::atoi(next_token(data, pos).c_str());
+    double scale = std::atof(next_token(data, pos).c_str());
+    pos++; // single whitespace character before the data
+    if (!channels || width <= 0 || height <= 0 || scale == 0.0) {
+        error = "malformed PFM header";
+        return false;
+    }
+    size_t values = static_cast<size_t>(width) * height * channels;
+    if (data.size() < pos + values * sizeof(float)) {
+        error = "PFM data is truncated";
+        return false;
+    }
+
+    const bool host_little_endian = [] { uint16_t one = 1; unsigned char b; std::memcpy(&b, &one, 1); return b == 1; }();
+    const bool swap = (scale < 0.0) != host_little_endian;
+    auto read_float = [&](size_t index) {
+        unsigned char bytes[4];
+        std::memcpy(bytes, &data[pos + index * sizeof(float)], 4);
+        if (swap) {
+            std::swap(bytes[0], bytes[3]);
+            std::swap(bytes[1], bytes[2]);
+        }
+        float value;
+        std::memcpy(&value, bytes, 4);
+        return static_cast<double>(value);
+    };
+
+    framebuffer.resize(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y) {
+        vector3* row = &framebuffer[static_cast<size_t>(height - 1 - y) * width];
+        for (int x = 0; x < width; ++x) {
+            size_t index = (static_cast<size_t>(y) * width + x) * channels;
+            row[x] = channels == 3 ? vector3(read_float(index), read_float(index + 1), read_float(index + 2))
+                                   : vector3(read_float(index), read_float(index), read_float(index));
+        }
+    }
+    return true;
+}
+
+// Inverse of to_rgbe, taking the centre of each mantissa step
+static vector3 from_rgbe(const unsigned char rgbe[4]) {
+    if (rgbe[3] == 0) return vector3(0, 0, 0);
+    double scale = std::ldexp(1.0, rgbe[3] - (128 + 8));
+    return vector3((rgbe[0] + 0.5) * scale, (rgbe[1] + 0.5) * scale, (rgbe[2] + 0.5) * scale);
+}
+
+// Only the "-Y height +X width" orientation that encode_hdr writes (and most tools use) is accepted
+static bool decode_hdr(const std::vector<unsigned char>& data, std::vector<vector3>& framebuffer, int& width, int& height, std::string& error) {
+    size_t pos = 0;
+    auto read_line = [&]() {
+        size_t start = pos;
+        while (pos < data.size() && data[pos] != '\n') pos++;
+        std::string line(data.begin() + start, data.begin() + pos);
+        if (pos < data.size()) pos++;
+        return line;
+    };
+
+    if (read_line().compare(0, 2, "#?") != 0) {
+        error = "not a Radiance HDR file";
+        return false;
+    }
+    for (std::string line = read_line(); !line.empty(); line = read_line()) {
+        if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+            error = "unsupported HDR pixel format " + line.substr(7);
+            return false;
+        }
+        if (pos >= data.size()) break;
+    }
+    char y_axis[3] = {}, x_axis[3] = {};
+    if (std::sscanf(read_line().c_str(), "%2s %d %2s %d", y_axis, &height, x_axis, &width) != 4 ||
+        std::string(y_axis) != "-Y" || std::string(x_axis) != "+X" || width <= 0 || height <= 0) {
+        error = "unsupported HDR resolution line";
+        return false;
+    }
+
+    framebuffer.resize(static_cast<size_t>(width) * height);
+    std::vector<unsigned char> channels(4 * width);
+    for (int y = 0; y < height; ++y) {
+        vector3* row = &framebuffer[static_cast<size_t>(y) * width];
+        bool rle = width >= 8 && width < 32768 && pos + 4 <= data.size() && data[pos] == 2 && data[pos + 1] == 2 &&
+                   ((data[pos + 2] << 8) | data[pos + 3]) == width;
+        if (!rle) {
+            if (pos + 4 * static_cast<size_t>(width) > data.size()) {
+                error = "HDR data is truncated";
+                return false;
+            }
+            for (int x = 0; x < width; ++x, pos += 4) row[x] = from_rgbe(&data[pos]);
+            continue;
+        }
+
+        pos += 4;
+        for (int c = 0; c < 4; ++c) {
+            unsigned char* values = &channels[c * width];
+            int x = 0;
+            while (x < width) {
+                if (pos >= data.size()) {
+                    error = "HDR data is truncated";
+                    return false;
+                }
+                int count = data[pos++];
+                bool run = count > 128;
+                if (run) count -= 128;
+                if (count == 0 || x + count > width || pos + (run ? 1 : count) > data.size()) {
+                    error = "corrupt HDR scanline";
+                    return false;
+                }
+                if (run) {
+                    std::fill(values + x, values + x + count, data[pos++]);
+                } else {
+                    std::copy(&data[pos], &data[pos] + count, values + x);
+                    pos += count;
+                }
+                x += count;
+            }
+        }
+        for (int x = 0; x < width; ++x) {
+            unsigned char rgbe[4] = { channels[x], channels[width + x], channels[2 * width + x], channels[3 * width + x] };
+            row[x] = from_rgbe(rgbe);
+        }
+    }
+    return true;
+}
+
+bool read_image(const std::string& filename, std::vector<vector3>& framebuffer, int& width, int& height, std::string& error) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    switch (image_format_for(filename)) {
+        case ImageFormat::PFM: return decode_pfm(data, framebuffer, width, height, error);
+        case ImageFormat::HDR: return decode_hdr(data, framebuffer, width, height, error);
+        default:
+            error = "only PFM and Radiance HDR frames can be read back";
+            return false;
+    }
+}
+
+StreamingImageWriter::~StreamingImageWriter() {
+    close();
+}
+
+bool StreamingImageWriter::open(const std::string& filename, ImageFormat image_format, int image_width, int image_height) {
+    if (!supports(image_format)) return false;
+    format = image_format;
+    width = image_width;
+    height = image_height;
+
+    std::string header = format == ImageFormat::P6
+        ? "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n"
+        : "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+    header_size = header.size();
+    size_t pixel_size = format == ImageFormat::P6 ? 3 : 3 * sizeof(float);
+
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, header_size + static_cast<size_t>(width) * height * pixel_size) != 0
+        || pwrite(fd, header.data(), header.size(), 0) != static_cast<ssize_t>(header.size())) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool StreamingImageWriter::write_rows(int y0, int rows, const std::vector<vector3>& pixels,
+                                      const ToneMapSettings& tone_mapping) {
+    if (fd < 0) return false;
+
+    // A band of full rows is one contiguous range of the file; PFM stores rows bottom to top, so its
+    // bytes are laid out in reverse row order and the range starts at the band's last row
+    std::vector<unsigned char> bytes;
+    size_t offset;
+    if (format == ImageFormat::P6) {
+        bytes.resize(pixels.size() * 3);
+        tone_map_to_rgb8(pixels.data(), pixels.size(), tone_mapping, bytes.data());
+        offset = header_size + static_cast<size_t>(y0) * width * 3;
+    } else {
+        bytes.resize(pixels.size() * 3 * sizeof(float));
+        float* data = reinterpret_cast<float*>(bytes.data());
+        for (int r = rows - 1; r >= 0; --r) {
+            const vector3* row = &pixels[static_cast<size_t>(r) * width];
+            for (int x = 0; x < width; ++x) {
+                *data++ = static_cast<float>(row[x].x);
+                *data++ = static_cast<float>(row[x].y);
+                *data++ = static_cast<float>(row[x].z);
+            }
+        }
+        offset = header_size + static_cast<size_t>(height - y0 - rows) * width * 3 * sizeof(float);
+    }
+
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = pwrite(fd, bytes.data() + written, bytes.size() - written, offset + written);
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+bool StreamingImageWriter::close() {
+    if (fd < 0) return true;
+    bool ok = ::close(fd) == 0;
+    fd = -1;
+    return ok;
+}
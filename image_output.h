@@ -0,0 +1,76 @@
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+
+#include <string>
+#include <vector>
+#include "vector3.h"
+#include "tone_mapping.h"
+
+enum class ImageFormat {
+    P3,   // ASCII PPM, 8-bit
+    P6,   // binary PPM, 8-bit
+    PFM,  // portable float map, linear 32-bit float RGB
+    HDR,  // Radiance RGBE with run-length encoded scanlines, linear
+    PNG,  // 8-bit RGB PNG, deflated in independent row strips
+    EXR   // OpenEXR, linear half-float RGB
+};
+
+// Parses "p3", "p6", "pfm", "hdr", "png" or "exr"; returns false for anything else
+bool parse_image_format(const std::string& name, ImageFormat& format);
+
+// Format implied by a file name: .pfm, .hdr, .png, .exr, otherwise binary PPM
+ImageFormat image_format_for(const std::string& filename);
+
+const char* image_format_name(ImageFormat format);
+
+// Encodes a framebuffer (rows top to bottom) into a complete file in memory. The 8-bit formats go through
+// the tone_map_to_rgb8 post-process stage; the float formats store the linear radiance untouched
+std::vector<unsigned char> encode_image(ImageFormat format, const std::vector<vector3>& framebuffer, int width, int height,
+                                        const ToneMapSettings& tone_mapping);
+
+// One full-resolution channel of a multi-channel image, rows top to bottom. A dot in the name separates
+// layer and channel ("albedo.R"); channels without one ("R", "G", "B") form the default layer
+struct ImageChannel {
+    std::string name;
+    std::vector<float> values;
+};
+
+// Scanline OpenEXR with every channel stored as half float, ZIP-compressed in chunks of 16 lines that
+// are converted and compressed in parallel
+std::vector<unsigned char> encode_exr(const std::vector<ImageChannel>& channels, int width, int height);
+
+bool write_exr(const std::string& filename, const std::vector<ImageChannel>& channels, int width, int height);
+
+// encode_image followed by a single write of the whole file
+bool write_image(const std::string& filename, ImageFormat format, const std::vector<vector3>& framebuffer, int width, int height,
+                 const ToneMapSettings& tone_mapping);
+
+// Loads a linear frame written as PFM or Radiance HDR (flat or run-length encoded) back into a
+// framebuffer, rows top to bottom, so it can be tone mapped again without re-rendering
+bool read_image(const std::string& filename, std::vector<vector3>& framebuffer, int& width, int& height, std::string& error);
+
+// Writes a binary PPM or PFM piece by piece: the file is sized up front and each band of rows goes
+// straight to its final offset with pwrite, so the whole image never has to be in memory.
+// write_rows may be called from several threads at once, for bands in any order
+class StreamingImageWriter {
+public:
+    // Only formats with a fixed size per pixel can be streamed
+    static bool supports(ImageFormat format) { return format == ImageFormat::P6 || format == ImageFormat::PFM; }
+
+    ~StreamingImageWriter();
+
+    bool open(const std::string& filename, ImageFormat format, int width, int height);
+
+    // Rows [y0, y0 + rows), given top to bottom; `tone_mapping` applies to P6 only, as in encode_image
+    bool write_rows(int y0, int rows, const std::vector<vector3>& pixels, const ToneMapSettings& tone_mapping);
+
+    bool close();
+
+private:
+    int fd = -1;
+    ImageFormat format = ImageFormat::P6;
+    int width = 0, height = 0;
+    size_t header_size = 0;
+};
+
+#endif
@@ -0,0 +1,8 @@
+// AVX2 variant of the kernels, compiled with -mavx2 (see the Makefile) and only called when
+// the CPU reports support for it
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_KERNELS_NAMESPACE kernels_avx2
+#define SIMD_KERNELS_TABLE avx2_kernels
+#define SIMD_KERNELS_ISA ISA::AVX2
+#include "simd_kernels.inc"
+#endif
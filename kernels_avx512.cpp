@@ -0,0 +1,8 @@
+// AVX-512 variant of the kernels, compiled with -mavx512f -mavx512dq -mavx512vl (see the Makefile) and
+// only called when the CPU reports support for it
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_KERNELS_NAMESPACE kernels_avx512
+#define SIMD_KERNELS_TABLE avx512_kernels
+#define SIMD_KERNELS_ISA ISA::AVX512
+#include "simd_kernels.inc"
+#endif
@@ -0,0 +1,6 @@
+// Kernels for the baseline the whole binary is built for, used on CPUs without any of the extensions
+// below and on other architectures
+#define SIMD_KERNELS_NAMESPACE kernels_generic
+#define SIMD_KERNELS_TABLE generic_kernels
+#define SIMD_KERNELS_ISA ISA::Generic
+#include "simd_kernels.inc"
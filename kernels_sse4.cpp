@@ -0,0 +1,8 @@
+// SSE4.2 variant of the kernels, compiled with -msse4.2 (see the Makefile) and only called when
+// the CPU reports support for it
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_KERNELS_NAMESPACE kernels_sse4
+#define SIMD_KERNELS_TABLE sse4_kernels
+#define SIMD_KERNELS_ISA ISA::SSE4
+#include "simd_kernels.inc"
+#endif
@@ -0,0 +1,29 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "vector3.h"
+
+enum class LightType {
+    Point,
+    Area
+};
+
+struct Light {
+    LightType type; // point or area
+    vector3 position; // centre of light source
+    vector3 intensity;
+    vector3 u; // u-axis for area light
+    vector3 v; // v-axis for area light
+    double width;
+    double height;
+    int samples = 32; // shadow-ray budget per shading point for area lights ("samples" in JSON)
+    
+    vector3 sample_point_on_surface() const;
+
+    // Point at (s, t) in [0, 1]^2 across the area light
+    vector3 point_at(double s, double t) const {
+        return position + (s * width * u) + (t * height * v);
+    }
+};
+
+#endif
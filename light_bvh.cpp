@@ -0,0 +1,114 @@
+#include "light_bvh.h"
+#include "sampler.h"
+
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+LightBVH::LightBVH(const std::vector<Light>& lights) {
+    std::vector<int> indices(lights.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    if (!indices.empty()) {
+        root = build_tree(lights, indices);
+    }
+}
+
+AABB LightBVH::light_bounds(const Light& light) {
+    AABB bounds;
+    bounds.expand(light.position);
+    if (light.type == LightType::Area) {
+        bounds.expand(light.point_at(1.0, 0.0));
+        bounds.expand(light.point_at(0.0, 1.0));
+        bounds.expand(light.point_at(1.0, 1.0));
+    }
+    return bounds;
+}
+
+double LightBVH::light_power(const Light& light) {
+    return (light.intensity.x + light.intensity.y + light.intensity.z) / 3.0;
+}
+
+// Same midpoint split on the axis of largest centroid extent as the shape BVH, down to one light per leaf
+std::shared_ptr<LightBVHNode> LightBVH::build_tree(const std::vector<Light>& lights, std::vector<int>& indices) {
+    auto node = std::make_shared<LightBVHNode>();
+    if (indices.size() == 1) {
+        node->light = indices[0];
+        node->bbox = light_bounds(lights[indices[0]]);
+        node->power = light_power(lights[indices[0]]);
+        return node;
+    }
+
+    AABB centroid_bbox;
+    for (int i : indices) {
+        centroid_bbox.expand(light_bounds(lights[i]).centroid());
+    }
+    vector3 extent = centroid_bbox.extent();
+    size_t axis = 0;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+    double midpoint = 0.5 * (centroid_bbox.min[axis] + centroid_bbox.max[axis]);
+
+    std::vector<int> left_indices, right_indices;
+    for (int i : indices) {
+        if (light_bounds(lights[i]).centroid()[axis] < midpoint) {
+            left_indices.push_back(i);
+        } else {
+            right_indices.push_back(i);
+        }
+    }
+
+    // Coincident lights: split the list in half
+    if (left_indices.empty() || right_indices.empty()) {
+        size_t half = indices.size() / 2;
+        left_indices.assign(indices.begin(), indices.begin() + half);
+        right_indices.assign(indices.begin() + half, indices.end());
+    }
+
+    node->left = build_tree(lights, left_indices);
+    node->right = build_tree(lights, right_indices);
+    node->bbox = node->left->bbox;
+    node->bbox.merge(node->right->bbox);
+    node->power = node->left->power + node->right->power;
+    return node;
+}
+
+double LightBVH::importance(const AABB& bbox, double power, const vector3& point, const vector3& normal, double cutoff) {
+    // Cone around the box as seen from the point
+    vector3 to_center = bbox.centroid() - point;
+    double distance = to_center.length();
+    double radius = 0.5 * bbox.extent().length();
+
+    double cos_bound = 1.0;
+    if (distance > radius) {
+        double cos_theta = std::clamp(normal.dot(to_center) / distance, -1.0, 1.0);
+        double theta = std::acos(cos_theta);
+        double spread = std::asin(radius / distance);
+        cos_bound = std::cos(std::max(0.0, theta - spread));
+    }
+
+    // Highlights are not clipped to the lit hemisphere, so lights behind the surface keep a small share
+    double estimate = power * std::max(cos_bound, 0.05);
+    return estimate < cutoff ? 0.0 : estimate;
+}
+
+int LightBVH::sample(const vector3& point, const vector3& normal, double cutoff, double& pmf) const {
+    pmf = 1.0;
+    if (!root || importance(root->bbox, root->power, point, normal, cutoff) <= 0.0) return -1;
+
+    const LightBVHNode* node = root.get();
+    while (!node->is_leaf()) {
+        double left = importance(node->left->bbox, node->left->power, point, normal, cutoff);
+        double right = importance(node->right->bbox, node->right->power, point, normal, cutoff);
+        if (left + right <= 0.0) return -1;
+
+        double p_left = left / (left + right);
+        if (sample_1d() < p_left) {
+            pmf *= p_left;
+            node = node->left.get();
+        } else {
+            pmf *= 1.0 - p_left;
+            node = node->right.get();
+        }
+    }
+    return node->light;
+}
@@ -0,0 +1,46 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <memory>
+#include <vector>
+#include "vector3.h"
+#include "bvh.h"
+#include "light.h"
+
+// Node of the light hierarchy: the box around its lights and their summed power
+class LightBVHNode {
+public:
+    AABB bbox;
+    double power = 0.0;
+    std::shared_ptr<LightBVHNode> left, right;
+    int light = -1; // index into the scene's lights for leaves
+
+    bool is_leaf() const { return light >= 0; }
+};
+
+// Hierarchy over the scene's lights for many-light sampling. Lights are picked by walking down the
+// tree and choosing each child with probability proportional to its estimated contribution.
+// The shading model has no distance falloff, so the estimate is power times a bound on the
+// cosine between the surface normal and any direction into the node's box
+class LightBVH {
+public:
+    std::shared_ptr<LightBVHNode> root;
+
+    LightBVH(const std::vector<Light>& lights);
+
+    // Estimated contribution of lights with the given bounds and power at a shading point;
+    // estimates below `cutoff` count as zero
+    static double importance(const AABB& bbox, double power, const vector3& point, const vector3& normal, double cutoff);
+
+    // Picks one light with probability `pmf`; returns -1 when every light is below the cutoff
+    int sample(const vector3& point, const vector3& normal, double cutoff, double& pmf) const;
+
+    // Bounding box and power of a single light
+    static AABB light_bounds(const Light& light);
+    static double light_power(const Light& light);
+
+private:
+    std::shared_ptr<LightBVHNode> build_tree(const std::vector<Light>& lights, std::vector<int>& indices);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef LUT_INTERPOLATION_H
+#define LUT_INTERPOLATION_H
+
+// Tetrahedral 3D LUT interpolation steps, shared by ColorLUT::apply and the tone-map block kernels so
+// every path gives identical results. The helpers are static and use no library templates: each
+// instruction-set variant of simd_kernels.inc gets its own copy compiled with its own flags
+
+// Position of one input component in the LUT grid, `scale` being (size - 1) / (domain_max - domain_min):
+// the lower grid index and the fraction towards the next. Written without branches (the compares become
+// min/max and blends) since neighbouring pixels can fall anywhere in the cube
+static inline int lut_cell(double value, double domain_min, double scale, int size, double& fraction) {
+    double t = (value - domain_min) * scale;
+    t = t > 0.0 ? t : 0.0; // NaN goes to 0
+    t = t < size - 1 ? t : size - 1;
+    int index = static_cast<int>(t);
+    index = index < size - 2 ? index : size - 2;
+    fraction = t - index;
+    return index;
+}
+
+// The corners of the tetrahedron containing (fr, fg, fb): the cell origin, one step along the largest
+// fraction, one more along the middle one, and the opposite corner. Ties pick either tetrahedron, which
+// blends the same values
+struct LUTTetrahedron {
+    int step1, step2;       // table offsets (in entries) of the second and third corner
+    double w0, w1, w2, w3;  // corner weights
+};
+
+static inline LUTTetrahedron lut_tetrahedron(double fr, double fg, double fb, int size) {
+    const int sr = 1, sg = size, sb = size * size;
+    int rg = fr > fg, gb = fg > fb, rb = fr > fb;
+    int r_largest = rg & rb, g_largest = (rg ^ 1) & gb;
+    int r_smallest = (rg | rb) ^ 1, g_smallest = rg & (gb ^ 1);
+    int largest = r_largest * sr + g_largest * sg + (1 - r_largest - g_largest) * sb;
+    int smallest = r_smallest * sr + g_smallest * sg + (1 - r_smallest - g_smallest) * sb;
+    double gb_high = fg < fb ? fb : fg;
+    double gb_low = fb < fg ? fb : fg;
+    double high = fr < gb_high ? gb_high : fr;
+    double low = gb_low < fr ? gb_low : fr;
+    double mid = fr + fg + fb - high - low;
+    return { largest, sr + sg + sb - smallest, 1.0 - high, high - mid, mid - low, low };
+}
+
+#endif
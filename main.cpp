@@ -4,7 +4,6 @@
 #include <omp.h>
 #include "json.hpp"
 #include "vector3.h"
-#include "colour.h"
 #include "ray.h"
 #include "camera.h"
 #include "scene.h"
@@ -13,6 +12,14 @@
 #include "cylinder.h"
 #include "tone_mapping.h"
 #include "utils.h"
+#include "benchmark.h"
+#include "wavefront.h"
+#include "sampler.h"
+#include "progressive.h"
+#include "checkpoint.h"
+#include "image_output.h"
+#include "aov.h"
+#include "cpu_dispatch.h"
 
 using json = nlohmann::json;
 
@@ -30,60 +37,328 @@ json load_json(const std::string& filename) {
     return data;
 }
 
-void render(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces, int samples_per_pixel, std::function<vector3(const vector3&)> tone_mapping, std::ofstream& outfile) {
+// One pixel of the default renderer: a single ray through the centre, or samples_per_pixel jittered
+// rays averaged when antialiasing is on. `trace` shades a camera ray
+template <typename Trace>
+vector3 render_pixel(const Scene& scene, const Camera& camera, int x, int y, int image_width, int image_height, int samples_per_pixel, Trace trace) {
+    vector3 pixel_color(0.0, 0.0, 0.0); // Final pixel color
+
+    if (scene.enable_antialiasing) {
+        // Antialiasing logic: Multi-sample and average
+        for (int s = 0; s < samples_per_pixel; ++s) {
+            // Create jitter
+            double u_offset = random_double(-1.0, 1.0);
+            double v_offset = random_double(-1.0, 1.0);
+
+            auto [u, v] = normalize_pixel(x + u_offset, y+ v_offset, image_width, image_height);
+            ray r = camera.get_ray(u, v);
+            pixel_color += trace(r); // Accumulate sample colors
+        }
+
+        // Average the accumulated color
+        pixel_color = pixel_color / (samples_per_pixel);
+
+    } else {
+        // No antialiasing: Single ray per pixel
+        auto [u, v] = normalize_pixel(x, y, image_width, image_height);
+        ray r = camera.get_ray(u, v);
+        pixel_color = trace(r);
+    }
+
+    return pixel_color;
+}
+
+// `aovs`, when given, also collects the first-hit AOVs of every sample traced for the beauty image
+void render(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces, int samples_per_pixel, std::vector<vector3>& framebuffer,
+            AOVBuffer* aovs = nullptr) {
     #pragma omp parallel for schedule(dynamic)
     for (int y = 0; y < image_height; ++y) {
+        AOVSample aov_sample;
+        if (aovs) active_aov() = &aov_sample;
+
         for (int x = 0; x < image_width; ++x) {
-            vector3 pixel_color(0.0, 0.0, 0.0); // Final pixel color
+            int index = y * image_width + x;
+            auto trace = [&](const ray& r) {
+                if (!aovs) return scene.shade(r, nbounces);
+                aov_sample.reset(scene.lights.size());
+                vector3 color = scene.shade(r, nbounces);
+                aovs->add(index, aov_sample);
+                return color;
+            };
+            framebuffer[index] = render_pixel(scene, camera, x, y, image_width, image_height, samples_per_pixel, trace);
+        }
 
-            if (scene.enable_antialiasing) {
-                // Antialiasing logic: Multi-sample and average
-                for (int s = 0; s < samples_per_pixel; ++s) {
-                    // Create jitter
-                    double u_offset = random_double(-1.0, 1.0);
-                    double v_offset = random_double(-1.0, 1.0);
+        active_aov() = nullptr;
+    }
+}
+
+// render() without a framebuffer: bands of `band_rows` full-width rows are rendered (one band per thread
+// in flight), tone-mapped and written straight to their place in the file, so memory no longer grows
+// with the image size
+bool render_streaming(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces, int samples_per_pixel,
+                      int band_rows, StreamingImageWriter& writer, const ToneMapSettings& tone_mapping) {
+    const int bands = (image_height + band_rows - 1) / band_rows;
+    bool ok = true;
 
-                    auto [u, v] = normalize_pixel(x + u_offset, y+ v_offset, image_width, image_height);
-                    ray r = camera.get_ray(u, v);
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (int b = 0; b < bands; ++b) {
+        int y0 = b * band_rows, rows = std::min(band_rows, image_height - y0);
+        std::vector<vector3> band(static_cast<size_t>(rows) * image_width);
+        auto trace = [&](const ray& r) { return scene.shade(r, nbounces); };
+        for (int y = y0; y < y0 + rows; ++y) {
+            for (int x = 0; x < image_width; ++x) {
+                band[static_cast<size_t>(y - y0) * image_width + x] = render_pixel(scene, camera, x, y, image_width, image_height, samples_per_pixel, trace);
+            }
+        }
+        ok = writer.write_rows(y0, rows, band, tone_mapping) && ok;
+    }
+    return ok;
+}
+
+// Adaptive antialiasing: every pixel takes min_samples jittered samples, then more in batches of
+// min_samples while the standard error of its mean luminance is above threshold, up to max_samples
+struct AdaptiveSampling {
+    bool enabled = false;
+    int min_samples = 8;
+    int max_samples = 64;
+    double threshold = 0.002;
+};
+
+void render_adaptive(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces, const AdaptiveSampling& adaptive, std::vector<vector3>& framebuffer, std::vector<int>& sample_counts) {
+    #pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < image_height; ++y) {
+        for (int x = 0; x < image_width; ++x) {
+            // Running mean and variance of the luminance (Welford)
+            vector3 color_sum(0.0, 0.0, 0.0);
+            double mean = 0.0, m2 = 0.0;
+            int n = 0;
 
-                    double t_hit;
-                    std::shared_ptr<Shape> hit_shape;
-                    vector3 sample_color = scene.backgroundcolor; // default
+            while (n < adaptive.max_samples) {
+                int batch = std::min(adaptive.min_samples, adaptive.max_samples - n);
+                for (int s = 0; s < batch; ++s) {
+                    // A uniform point anywhere in the pixel; normalize_pixel would truncate it back to the corner
+                    auto [u, v] = jitter_pixel(x, y, random_double(0.0, 1.0), random_double(0.0, 1.0), image_width, image_height);
+                    vector3 sample_color = scene.shade(camera.get_ray(u, v), nbounces);
 
-                    sample_color = scene.shade(r, nbounces);
-                    pixel_color += sample_color; // Accumulate sample colors
+                    color_sum += sample_color;
+                    double luminance = 0.2126 * sample_color.x + 0.7152 * sample_color.y + 0.0722 * sample_color.z;
+                    ++n;
+                    double delta = luminance - mean;
+                    mean += delta / n;
+                    m2 += delta * (luminance - mean);
                 }
 
-                // Average the accumulated color
-                pixel_color = pixel_color / (samples_per_pixel);
-                
-            } else {
-                // No antialiasing: Single ray per pixel
-                auto [u, v] = normalize_pixel(x, y, image_width, image_height);
-                ray r = camera.get_ray(u, v);
+                double standard_error = n > 1 ? std::sqrt(m2 / (n - 1) / n) : 0.0;
+                if (standard_error <= adaptive.threshold) break;
+            }
+
+            framebuffer[y * image_width + x] = color_sum / n;
+            sample_counts[y * image_width + x] = n;
+        }
+    }
+}
+
+// Samples per pixel as a blue (min_samples) to red (max_samples) ramp
+bool write_sample_heatmap(const std::string& filename, const std::vector<int>& sample_counts, int image_width, int image_height, const AdaptiveSampling& adaptive) {
+    std::vector<vector3> heatmap;
+    heatmap.reserve(sample_counts.size());
+    double range = std::max(1, adaptive.max_samples - adaptive.min_samples);
+    for (int count : sample_counts) {
+        double f = std::min(std::max((count - adaptive.min_samples) / range, 0.0), 1.0);
+        heatmap.push_back(vector3(f, 0.2 * (1.0 - std::abs(2.0 * f - 1.0)), 1.0 - f));
+    }
+    return write_image(filename, image_format_for(filename), heatmap, image_width, image_height, ToneMapSettings());
+}
+
+// Traces primary rays as TILE x TILE packets; secondary rays continue one by one
+template <int TILE>
+void render_packets(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces, int samples_per_pixel, std::vector<vector3>& framebuffer, PacketStats& stats) {
+    const int N = TILE * TILE;
+    const int samples = scene.enable_antialiasing ? samples_per_pixel : 1;
 
-                double t_hit;
-                std::shared_ptr<Shape> hit_shape;
-                pixel_color = scene.backgroundcolor;
+    #pragma omp parallel for schedule(dynamic)
+    for (int ty = 0; ty < image_height; ty += TILE) {
+        PacketStats row_stats;
 
-                pixel_color = scene.shade(r, nbounces);
+        for (int tx = 0; tx < image_width; tx += TILE) {
+            // Lanes past the image edge repeat the last pixel so their rays stay valid, but are masked off
+            maskxN<N> active;
+            int px[N], py[N];
+            for (int i = 0; i < N; ++i) {
+                active.set(i, tx + i % TILE < image_width && ty + i / TILE < image_height);
+                px[i] = std::min(tx + i % TILE, image_width - 1);
+                py[i] = std::min(ty + i / TILE, image_height - 1);
             }
 
-            // Apply tone mapping and gamma correction
-            pixel_color = tone_mapping ? tone_mapping(pixel_color) : pixel_color;
+            vector3 tile_color[N];
+            for (int s = 0; s < samples; ++s) {
+                doublexN<N> u, v;
+                for (int i = 0; i < N; ++i) {
+                    if (scene.enable_antialiasing) {
+                        // Same jitter as the scalar path
+                        double u_offset = random_double(-1.0, 1.0);
+                        double v_offset = random_double(-1.0, 1.0);
+                        std::tie(u[i], v[i]) = normalize_pixel(px[i] + u_offset, py[i] + v_offset, image_width, image_height);
+                    } else {
+                        std::tie(u[i], v[i]) = normalize_pixel(px[i], py[i], image_width, image_height);
+                    }
+                }
+
+                vector3 colors[N];
+                scene.shade(camera.get_ray(u, v), active, nbounces, colors, row_stats);
+                for (int i = 0; i < N; ++i) tile_color[i] += colors[i];
+            }
 
-            // Write the final color to the output
-            write_colour(outfile, pixel_color);
+            for (int i = 0; i < N; ++i) {
+                if (active[i]) framebuffer[py[i] * image_width + px[i]] = tile_color[i] / samples;
+            }
         }
+
+        #pragma omp critical
+        stats.merge(row_stats);
     }
 }
 
+// Loads a .cube file and makes it the tone-mapping operator
+void use_lut(const std::string& filename, ToneMapSettings& tone_mapping) {
+    auto lut = std::make_shared<ColorLUT>();
+    std::string error;
+    if (!load_cube_lut(filename, *lut, error)) {
+        throw std::runtime_error("Failed to load LUT " + filename + ": " + error);
+    }
+    tone_mapping.op = ToneMapOperator::LUT;
+    tone_mapping.lut = lut;
+}
+
+// --tone-map <none|exposure|reinhard|aces>, --lut <file.cube>, --exposure <e>, --gamma <g>,
+// --auto-exposure [key] and --exposure-percentiles <low> <high>; returns false when argv[i] is none of
+// them, otherwise leaves i on the last argument consumed
+bool parse_tone_map_flag(int argc, char* argv[], int& i, ToneMapSettings& tone_mapping, AutoExposureSettings& auto_exposure) {
+    std::string arg = argv[i];
+    if (arg == "--auto-exposure") {
+        auto_exposure.enabled = true;
+
+        // Optional key
+        if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+            auto_exposure.key = std::stod(argv[++i]);
+        }
+    } else if (arg == "--exposure-percentiles" && i + 2 < argc) {
+        auto_exposure.enabled = true;
+        auto_exposure.low_percentile = std::stod(argv[++i]);
+        auto_exposure.high_percentile = std::stod(argv[++i]);
+    } else if (i + 1 >= argc) {
+        return false;
+    } else if (arg == "--tone-map") {
+        if (!parse_tone_map_operator(argv[++i], tone_mapping.op)) {
+            throw std::invalid_argument("Unknown tone mapping method: " + std::string(argv[i]));
+        }
+    } else if (arg == "--lut") {
+        use_lut(argv[++i], tone_mapping);
+    } else if (arg == "--exposure") {
+        tone_mapping.op = ToneMapOperator::Exposure;
+        tone_mapping.exposure = std::stof(argv[++i]);
+    } else if (arg == "--gamma") {
+        tone_mapping.gamma = std::stof(argv[++i]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Runs the auto-exposure pass over a finished frame and reports what it found
+void auto_expose(const std::vector<vector3>& framebuffer, int width, int height, const AutoExposureSettings& auto_exposure, ToneMapSettings& tone_mapping) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    double average = apply_auto_exposure(framebuffer.data(), width, height, auto_exposure, tone_mapping);
+    std::chrono::duration<double> elapsed_time = std::chrono::high_resolution_clock::now() - start_time;
+    std::cout << "Auto exposure: average luminance " << average << " (" << auto_exposure.low_percentile << "-"
+              << auto_exposure.high_percentile << " percentile), scale " << tone_mapping.scale << ", "
+              << elapsed_time.count() * 1000.0 << " ms\n";
+}
+
+// Runs only the post-process stage on a saved linear frame (PFM or HDR), e.g. to try another tone
+// mapping without rendering again
+int retone_map(const std::string& input_file, int argc, char* argv[]) {
+    std::vector<vector3> framebuffer;
+    int width = 0, height = 0;
+    std::string error;
+    if (!read_image(input_file, framebuffer, width, height, error)) {
+        std::cerr << "Failed to read " << input_file << ": " << error << "\n";
+        return 1;
+    }
+
+    ToneMapSettings tone_mapping;
+    AutoExposureSettings auto_exposure;
+    std::string output_file = "tonemapped.ppm";
+    bool format_chosen = false;
+    ImageFormat output_format = ImageFormat::P6;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (parse_tone_map_flag(argc, argv, i, tone_mapping, auto_exposure)) {
+            continue;
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            format_chosen = true;
+            if (!parse_image_format(argv[++i], output_format)) {
+                std::cerr << "Unknown image format: " << argv[i] << " (p3, p6, pfm, hdr, png or exr)\n";
+                return 1;
+            }
+        }
+    }
+    if (!format_chosen) {
+        output_format = image_format_for(output_file);
+    }
+    if (auto_exposure.enabled) {
+        auto_expose(framebuffer, width, height, auto_exposure, tone_mapping);
+    }
+
+    // The frame is tone mapped once, inside the encoder, so the time covers mapping, encoding and writing
+    auto start_time = std::chrono::high_resolution_clock::now();
+    if (!write_image(output_file, output_format, framebuffer, width, height, tone_mapping)) {
+        std::cerr << "Failed to write " << output_file << "\n";
+        return 1;
+    }
+    std::chrono::duration<double> output_time = std::chrono::high_resolution_clock::now() - start_time;
+    std::cout << "Tone mapped and wrote " << width << "x" << height << " frame to " << output_file << " ("
+              << image_format_name(output_format) << ") in " << output_time.count() * 1000.0 << " ms\n";
+    return 0;
+}
+
 
 int main(int argc, char* argv[]) {
 
+    // --isa applies to every mode, so it is taken out of the arguments before any of them are parsed
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) != "--isa") continue;
+        ISA isa;
+        if (i + 1 >= argc || !parse_isa(argv[i + 1], isa)) {
+            std::cerr << "--isa needs one of generic, sse4, avx2, avx512\n";
+            return 1;
+        }
+        if (!set_isa(isa)) {
+            std::cerr << "This CPU does not support " << isa_name(isa) << " (best is " << isa_name(detect_isa()) << ")\n";
+            return 1;
+        }
+        for (int j = i; j + 2 <= argc; ++j) argv[j] = argv[j + 2];
+        argc -= 2;
+        --i;
+    }
+
+    // Micro-benchmarks don't need a scene
+    if (argc >= 3 && std::string(argv[1]) == "--benchmark") {
+        return run_benchmark(argv[2], argc - 3, argv + 3);
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--tonemap") {
+        return retone_map(argv[2], argc - 3, argv + 3);
+    }
+
     // Load JSON
     if (argc < 2) {
         std::cerr << "Usage: " << argv[0] << " <jsons/binary_primitves.json>\n";
+        std::cerr << "       " << argv[0] << " --benchmark packets|isa\n";
+        std::cerr << "       " << argv[0] << " <scene.json> [--bvh] --benchmark primary|samplers|output\n";
+        std::cerr << "       " << argv[0] << " --tonemap <frame.pfm|frame.hdr> [--output file] [--tone-map op | --lut file.cube] [--exposure e] [--gamma g] [--auto-exposure [key]]\n";
+        std::cerr << "Any mode also takes --isa generic|sse4|avx2|avx512 to override the detected kernel variant\n";
         return 1;
     }
 
@@ -108,32 +383,199 @@ int main(int argc, char* argv[]) {
         vector3(camera_json["upVector"][0], camera_json["upVector"][1], camera_json["upVector"][2])
     );
 
-    // Tone mapping
-    std::function<vector3(const vector3&)> tone_mapping = nullptr;
+    // Tone mapping, applied by the post-process stage when an 8-bit image is written. "exposure": "auto"
+    // derives the exposure from the finished frame instead
+    ToneMapSettings tone_mapping;
+    AutoExposureSettings auto_exposure;
     if (camera_json.contains("tone_mapping")) {
         std::string tone_mapping_str = camera_json["tone_mapping"];
 
-        if (tone_mapping_str == "reinhard") {
-            tone_mapping = reinhard_tone_mapping;
-        } else if (tone_mapping_str == "aces") {
-            tone_mapping = aces_tone_mapping;
-        } else {
+        if (!parse_tone_map_operator(tone_mapping_str, tone_mapping.op)) {
             throw std::invalid_argument("Unknown tone mapping method: " + tone_mapping_str);
         }
     } else { // Default to exposure tone mapping
-        float exposure = camera_json["exposure"];
-        tone_mapping = [exposure](const vector3& color) {
-            return exposure_tone_mapping(color, exposure);
-        };
+        tone_mapping.op = ToneMapOperator::Exposure;
+    }
+    if (camera_json.contains("exposure")) {
+        if (camera_json["exposure"].is_string()) {
+            if (camera_json["exposure"] != "auto") {
+                throw std::invalid_argument("Exposure must be a number or \"auto\"");
+            }
+            auto_exposure.enabled = true;
+        } else {
+            tone_mapping.exposure = camera_json["exposure"];
+        }
+    } else if (tone_mapping.op == ToneMapOperator::Exposure) {
+        throw std::invalid_argument("Exposure tone mapping needs an \"exposure\"");
+    }
+    if (camera_json.contains("auto_exposure")) {
+        const auto& auto_json = camera_json["auto_exposure"];
+        auto_exposure.key = auto_json.value("key", auto_exposure.key);
+        auto_exposure.low_percentile = auto_json.value("low_percentile", auto_exposure.low_percentile);
+        auto_exposure.high_percentile = auto_json.value("high_percentile", auto_exposure.high_percentile);
+        auto_exposure.stride = auto_json.value("stride", auto_exposure.stride);
+    }
+    tone_mapping.gamma = camera_json.value("gamma", 1.0f);
+    if (camera_json.contains("lut")) { // a baked tone curve and grade replaces the operator
+        use_lut(camera_json["lut"], tone_mapping);
     }
 
     // Parse command-line argument for flags
     int samples_per_pixel = 4; // default
+    int packet_tile = 0; // 0 = scalar primary rays
+    bool use_wavefront = false;
+    bool sort_secondary_rays = false;
+    bool use_light_bvh = false;
+    AdaptiveSampling adaptive_aa;
+    bool use_sampler = false;
+    SamplerType sampler_type = SamplerType::Random;
+    bool use_progressive = false;
+    ProgressiveSettings progressive;
+    std::string snapshot_file = "snapshot.ppm";
+    double time_budget = 0.0; // seconds, 0 = no deadline
+    std::string checkpoint_file; // empty = no checkpoints
+    bool resume = false;
+    std::string heatmap_file;
+    std::string output_file = "rendered_image.ppm";
+    std::string aov_file; // empty = no AOVs
+    int stream_rows = 0; // 0 = render into a framebuffer
+    bool format_chosen = false;
+    ImageFormat output_format = ImageFormat::P6;
+    size_t wavefront_batch = 8192; // pixels per wave
+    std::string benchmark_name;
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
 
         if (arg == "--bvh") {
             scene.use_bvh = true;
+        } else if (parse_tone_map_flag(argc, argv, i, tone_mapping, auto_exposure)) {
+            continue;
+        } else if (arg == "--packets" && i + 1 < argc) {
+            packet_tile = std::stoi(argv[++i]);
+            if (packet_tile != 4 && packet_tile != 8) {
+                std::cerr << "Packet tile size must be 4 or 8, got " << packet_tile << "\n";
+                return 1;
+            }
+        } else if (arg == "--wavefront") {
+            use_wavefront = true;
+
+            // Optional batch size (pixels per wave)
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                wavefront_batch = std::stoul(argv[++i]);
+            }
+        } else if (arg == "--iterative") {
+            scene.use_iterative = true;
+        } else if (arg == "--min-throughput") {
+            // Optional threshold; by default drop rays that can no longer move a pixel by one 8-bit step
+            scene.use_iterative = true;
+            scene.min_throughput = 1.0 / 255.0;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                scene.min_throughput = std::stod(argv[++i]);
+            }
+        } else if (arg == "--roulette") {
+            // Optional throughput below which Russian roulette starts
+            scene.use_iterative = true;
+            scene.russian_roulette = true;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                scene.roulette_threshold = std::stod(argv[++i]);
+            }
+        } else if (arg == "--occluder-cache") {
+            scene.use_occluder_cache = true;
+        } else if (arg == "--adaptive-shadows") {
+            scene.adaptive_shadows = true;
+        } else if (arg == "--light-sampling" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "uniform") {
+                scene.light_sampling = LightSampling::Uniform;
+            } else if (mode == "stratified") {
+                scene.light_sampling = LightSampling::Stratified;
+            } else if (mode == "solid-angle") {
+                scene.light_sampling = LightSampling::SolidAngle;
+            } else {
+                std::cerr << "Unknown light sampling: " << mode << " (uniform, stratified or solid-angle)\n";
+                return 1;
+            }
+        } else if (arg == "--light-bvh") {
+            use_light_bvh = true;
+
+            // Optional number of lights drawn per shading point
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                scene.light_picks = std::stoi(argv[++i]);
+            }
+        } else if (arg == "--light-cutoff" && i + 1 < argc) {
+            scene.light_cutoff = std::stod(argv[++i]);
+        } else if (arg == "--fresnel") {
+            scene.stochastic_fresnel = true;
+        } else if (arg == "--sort-rays") {
+            sort_secondary_rays = true;
+        } else if (arg == "--benchmark" && i + 1 < argc) {
+            benchmark_name = argv[++i];
+        } else if (arg == "--adaptive-aa") {
+            adaptive_aa.enabled = true;
+
+            // Optional minimum and maximum samples per pixel
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                adaptive_aa.min_samples = std::max(1, std::stoi(argv[++i]));
+            }
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                adaptive_aa.max_samples = std::max(adaptive_aa.min_samples, std::stoi(argv[++i]));
+            }
+        } else if (arg == "--aa-threshold" && i + 1 < argc) {
+            adaptive_aa.threshold = std::stod(argv[++i]);
+        } else if (arg == "--aa-heatmap") {
+            heatmap_file = "aa_heatmap.ppm";
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                heatmap_file = argv[++i];
+            }
+        } else if (arg == "--sampler" && i + 1 < argc) {
+            use_sampler = true;
+            if (!parse_sampler_type(argv[++i], sampler_type)) {
+                std::cerr << "Unknown sampler: " << argv[i] << " (random, stratified, halton, sobol or blue-noise)\n";
+                return 1;
+            }
+        } else if (arg == "--progressive") {
+            use_progressive = true;
+
+            // Optional target samples per pixel
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                progressive.max_passes = std::stoi(argv[++i]);
+            }
+        } else if (arg == "--snapshot-passes" && i + 1 < argc) {
+            progressive.snapshot_passes = std::stoi(argv[++i]);
+        } else if (arg == "--snapshot-seconds" && i + 1 < argc) {
+            progressive.snapshot_seconds = std::stod(argv[++i]);
+        } else if (arg == "--snapshot-file" && i + 1 < argc) {
+            snapshot_file = argv[++i];
+        } else if (arg == "--noise-target" && i + 1 < argc) {
+            progressive.noise_threshold = std::stod(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (arg == "--aovs") {
+            aov_file = "aovs.exr";
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                aov_file = argv[++i];
+            }
+        } else if (arg == "--stream") {
+            stream_rows = 16;
+
+            // Optional rows per band
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                stream_rows = std::max(1, std::stoi(argv[++i]));
+            }
+        } else if (arg == "--format" && i + 1 < argc) {
+            format_chosen = true;
+            if (!parse_image_format(argv[++i], output_format)) {
+                std::cerr << "Unknown image format: " << argv[i] << " (p3, p6, pfm, hdr, png or exr)\n";
+                return 1;
+            }
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_file = argv[++i];
+        } else if (arg == "--checkpoint-seconds" && i + 1 < argc) {
+            progressive.checkpoint_seconds = std::stod(argv[++i]);
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--time-budget" && i + 1 < argc) {
+            time_budget = std::stod(argv[++i]);
         } else if (arg == "--aa") {
             scene.enable_antialiasing = true;
 
@@ -154,29 +596,275 @@ int main(int argc, char* argv[]) {
     if (scene.use_bvh) {
         scene.build_bvh();
     }
+    if (use_light_bvh) {
+        scene.build_light_bvh();
+    }
+
+    if (use_wavefront && packet_tile) {
+        std::cerr << "--wavefront and --packets are separate render modes, pick one\n";
+        return 1;
+    }
+    if (sort_secondary_rays && !(use_wavefront && scene.use_bvh)) {
+        // Sorting is there to make BVH traversal coherent, and only the BVH counts node reuse
+        std::cerr << "--sort-rays only works with --wavefront --bvh\n";
+        return 1;
+    }
+    if (use_wavefront && scene.adaptive_shadows) {
+        std::cerr << "--adaptive-shadows does not work with --wavefront, which batches all shadow rays up front\n";
+        return 1;
+    }
+    if (use_progressive && (use_wavefront || packet_tile || adaptive_aa.enabled)) {
+        std::cerr << "--progressive only works with the default renderer\n";
+        return 1;
+    }
+    if (time_budget > 0.0 && (use_progressive || use_wavefront || packet_tile || adaptive_aa.enabled)) {
+        std::cerr << "--time-budget only works with the default renderer\n";
+        return 1;
+    }
+    if (!aov_file.empty() && (use_progressive || time_budget > 0.0 || use_sampler || use_wavefront || packet_tile || adaptive_aa.enabled)) {
+        std::cerr << "--aovs only works with the default renderer\n";
+        return 1;
+    }
+    if (stream_rows && (!aov_file.empty() || use_progressive || time_budget > 0.0 || use_sampler || use_wavefront
+                        || packet_tile || adaptive_aa.enabled)) {
+        std::cerr << "--stream only works with the default renderer\n";
+        return 1;
+    }
+    if ((resume || !checkpoint_file.empty()) && !use_progressive) {
+        std::cerr << "--checkpoint and --resume only work with --progressive\n";
+        return 1;
+    }
+    if (resume && checkpoint_file.empty()) {
+        checkpoint_file = "render.ckpt";
+    }
+    bool sampler_chosen = use_sampler;
+    if (use_progressive || time_budget > 0.0) {
+        // Progressive and deadline samples always come from a sampler; Sobol unless one was picked
+        progressive.sampler = use_sampler ? sampler_type : SamplerType::Sobol;
+        use_sampler = false;
+    }
+    if (use_sampler && (use_wavefront || packet_tile || adaptive_aa.enabled)) {
+        std::cerr << "--sampler only works with the default renderer\n";
+        return 1;
+    }
+    if (adaptive_aa.enabled && (use_wavefront || packet_tile)) {
+        std::cerr << "--adaptive-aa only works with the default renderer\n";
+        return 1;
+    }
 
-    // Render image
     const int image_width = camera_json["width"];
     const int image_height = camera_json["height"];
-    std::ofstream outfile("rendered_image.ppm");
-    if (!outfile.is_open()) {
-        std::cerr << "Error: Could not open output file.\n";
+
+    if (!benchmark_name.empty()) {
+        return run_scene_benchmark(benchmark_name, scene, camera, image_width, image_height, nbounces);
+    }
+
+    // Render image
+    if (!format_chosen) {
+        output_format = image_format_for(output_file);
+    }
+    AccumulationBuffer accum;
+    if (resume) {
+        CheckpointInfo info;
+        std::string error;
+        if (!load_checkpoint(checkpoint_file, accum, info, error)) {
+            std::cerr << "Error: " << error << "\n";
+            return 1;
+        }
+        if (accum.width != image_width || accum.height != image_height || info.nbounces != nbounces
+            || (sampler_chosen && info.sampler != progressive.sampler)) {
+            std::cerr << "Error: " << checkpoint_file << " was rendered with different settings ("
+                      << accum.width << "x" << accum.height << ", " << info.nbounces << " bounces, "
+                      << sampler_name(info.sampler) << " sampler)\n";
+            return 1;
+        }
+        if (info.sampler == SamplerType::Stratified && info.strata != progressive.max_passes) {
+            // The strata are cut for the pass target, so another target would take other samples
+            std::cerr << "Error: " << checkpoint_file << " was rendered with " << info.strata
+                      << " strata per pixel; resume it with --progressive " << info.strata << "\n";
+            return 1;
+        }
+        progressive.sampler = info.sampler;
+        std::cout << "Resuming " << checkpoint_file << " at " << accum.passes << " passes\n";
+    }
+
+    // Only checks that the file can be written; nothing is created or truncated before the real write
+    if (!is_writable_path(output_file)) {
+        std::cerr << "Error: Could not open output file " << output_file << ".\n";
         return 1;
     }
-    outfile << "P3\n" << image_width << " " << image_height << "\n255\n";
+
+    // Streaming writes into the output file as it goes and never needs a framebuffer
+    StreamingImageWriter stream_writer;
+    if (stream_rows) {
+        if (!StreamingImageWriter::supports(output_format)) {
+            std::cerr << "--stream needs a p6 or pfm output\n";
+            return 1;
+        }
+        if (auto_exposure.enabled && output_format == ImageFormat::P6) {
+            std::cerr << "Auto exposure needs the whole frame before tone mapping, so it cannot stream to p6\n";
+            return 1;
+        }
+        if (!stream_writer.open(output_file, output_format, image_width, image_height)) {
+            std::cerr << "Error: Could not open output file " << output_file << ".\n";
+            return 1;
+        }
+    }
+
+    std::vector<vector3> framebuffer(stream_rows ? 0 : image_width * image_height);
+    std::vector<int> sample_counts;
+    PacketStats packet_stats;
+    WavefrontStats wavefront_stats;
+    ProgressiveStats progressive_stats;
+    TimeBudgetStats time_budget_stats;
+    AOVBuffer aovs;
+    if (!aov_file.empty()) aovs.resize(image_width, image_height, scene.lights.size());
 
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    render(scene, camera, image_width, image_height, nbounces, samples_per_pixel, tone_mapping, outfile);
+    if (stream_rows) {
+        if (!render_streaming(scene, camera, image_width, image_height, nbounces, samples_per_pixel, stream_rows, stream_writer, tone_mapping)
+            || !stream_writer.close()) {
+            std::cerr << "Error: Could not write " << output_file << ".\n";
+            return 1;
+        }
+    } else if (time_budget > 0.0) {
+        accum.resize(image_width, image_height);
+        render_time_budget(scene, camera, nbounces, time_budget, progressive.sampler, 16, accum, time_budget_stats);
+        accum.resolve(framebuffer);
+    } else if (use_progressive) {
+        if (!resume) accum.resize(image_width, image_height);
+        auto snapshot = [&](const std::vector<vector3>& image) {
+            ToneMapSettings snapshot_tone_mapping = tone_mapping;
+            if (auto_exposure.enabled) {
+                apply_auto_exposure(image.data(), image_width, image_height, auto_exposure, snapshot_tone_mapping);
+            }
+            write_image(snapshot_file, image_format_for(snapshot_file), image, image_width, image_height, snapshot_tone_mapping);
+        };
+        std::function<void(const AccumulationBuffer&)> checkpoint;
+        if (!checkpoint_file.empty()) {
+            checkpoint = [&](const AccumulationBuffer& buffer) {
+                std::string error;
+                if (!save_checkpoint(checkpoint_file, buffer, {nbounces, progressive.sampler, progressive.max_passes}, error)) {
+                    std::cerr << "Warning: checkpoint failed: " << error << "\n";
+                }
+            };
+        }
+        render_progressive(scene, camera, nbounces, progressive, accum, snapshot, checkpoint, progressive_stats);
+        accum.resolve(framebuffer);
+    } else if (use_sampler) {
+        int samples = scene.enable_antialiasing ? samples_per_pixel : 1;
+        render_sampled(scene, camera, image_width, image_height, nbounces, sampler_type, samples, framebuffer);
+    } else if (adaptive_aa.enabled) {
+        sample_counts.resize(framebuffer.size());
+        render_adaptive(scene, camera, image_width, image_height, nbounces, adaptive_aa, framebuffer, sample_counts);
+    } else if (use_wavefront) {
+        render_wavefront(scene, camera, image_width, image_height, nbounces, samples_per_pixel, wavefront_batch, sort_secondary_rays, framebuffer, wavefront_stats);
+    } else if (packet_tile == 4) {
+        render_packets<4>(scene, camera, image_width, image_height, nbounces, samples_per_pixel, framebuffer, packet_stats);
+    } else if (packet_tile == 8) {
+        render_packets<8>(scene, camera, image_width, image_height, nbounces, samples_per_pixel, framebuffer, packet_stats);
+    } else {
+        render(scene, camera, image_width, image_height, nbounces, samples_per_pixel, framebuffer, aov_file.empty() ? nullptr : &aovs);
+    }
 
     auto end_time = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed_time = end_time - start_time;
-    
+
+    // Apply tone mapping (8-bit formats only) and write the final colours to the output
+    if (auto_exposure.enabled && !stream_rows) {
+        auto_expose(framebuffer, image_width, image_height, auto_exposure, tone_mapping);
+    }
+    if (!stream_rows && !write_image(output_file, output_format, framebuffer, image_width, image_height, tone_mapping)) {
+        std::cerr << "Error: Could not write " << output_file << ".\n";
+        return 1;
+    }
+
+    if (!aov_file.empty()) {
+        auto aov_start = std::chrono::high_resolution_clock::now();
+        if (!write_aovs(aov_file, framebuffer, aovs)) {
+            std::cerr << "Error: Could not write " << aov_file << ".\n";
+            return 1;
+        }
+        std::chrono::duration<double> aov_time = std::chrono::high_resolution_clock::now() - aov_start;
+        std::cout << "AOVs written to " << aov_file << " (beauty, Z, normal, albedo, " << scene.lights.size()
+                  << " light layers) in " << aov_time.count() << " seconds.\n";
+    }
+
     std::cout << "Render completed in: " << elapsed_time.count() << " seconds.\n";
     std::cout << "BVH enabled: " << (scene.use_bvh ? "Yes" : "No") << "\n";
     std::cout << "Antialiasing applied: " << (scene.enable_antialiasing ? "Yes" : "No") << "\n";
+    if (stream_rows) {
+        std::cout << "Streamed to " << output_file << " in bands of " << stream_rows << " rows\n";
+    }
+    if (time_budget > 0.0) {
+        std::cout << "Time budget: " << time_budget_stats.seconds << " of " << time_budget << " seconds used, "
+                  << time_budget_stats.rounds << " rounds over 16x16 tiles, samples per pixel "
+                  << time_budget_stats.min_samples << "-" << time_budget_stats.max_samples
+                  << " (mean " << time_budget_stats.mean_samples << ", " << sampler_name(progressive.sampler) << " sampler)\n";
+    }
+    if (use_progressive) {
+        std::cout << "Progressive: " << accum.passes << " passes (" << sampler_name(progressive.sampler) << " sampler), "
+                  << "noise " << accum.noise() << ", "
+                  << progressive_stats.snapshots << " snapshots to " << snapshot_file << ", "
+                  << "stopped by " << progressive_stop_name(progressive_stats.stop) << "\n";
+        if (!checkpoint_file.empty()) {
+            std::cout << "Checkpoints: " << progressive_stats.checkpoints << " to " << checkpoint_file << "\n";
+        }
+    }
+    if (use_sampler) {
+        std::cout << "Sampler: " << sampler_name(sampler_type) << "\n";
+    }
+    if (adaptive_aa.enabled) {
+        long total = 0;
+        for (int count : sample_counts) total += count;
+        std::cout << "Adaptive antialiasing: " << adaptive_aa.min_samples << "-" << adaptive_aa.max_samples
+                  << " samples, threshold " << adaptive_aa.threshold << ", "
+                  << static_cast<double>(total) / sample_counts.size() << " samples per pixel on average\n";
+        if (!heatmap_file.empty()) {
+            if (write_sample_heatmap(heatmap_file, sample_counts, image_width, image_height, adaptive_aa)) {
+                std::cout << "Sample-count heatmap written to " << heatmap_file << "\n";
+            }
+        }
+    }
+    const ShadowStats shadow = scene.shadow_stats();
+    std::cout << "Shadow rays: " << shadow.shadow_rays;
+    if (scene.adaptive_shadows) {
+        std::cout << " (" << shadow.penumbra_escalations << " area-light probes escalated to the full budget)";
+    }
+    std::cout << "\n";
+    if (scene.use_occluder_cache) {
+        long lookups = shadow.occluder_cache_lookups;
+        long hits = shadow.occluder_cache_hits;
+        std::cout << "Shadow occluder cache: " << hits << "/" << lookups << " lookups hit ("
+                  << (lookups ? 100.0 * hits / lookups : 0.0) << "%), "
+                  << (shadow.shadow_rays ? 100.0 * hits / shadow.shadow_rays : 0.0) << "% of shadow rays skipped traversal\n";
+    }
+    if (scene.use_iterative || use_wavefront) {
+        const ShadingStats shading = scene.shading_stats();
+        std::cout << "Ray tree: "
+                  << shading.rays_spawned << " secondary rays spawned, "
+                  << shading.rays_pruned << " pruned below throughput " << scene.min_throughput << ", "
+                  << shading.rays_terminated << " terminated by Russian roulette\n";
+    }
+    if (packet_tile) {
+        std::cout << "Packet tracing: " << packet_tile << "x" << packet_tile << " tiles, "
+                  << packet_stats.packets << " packets, "
+                  << packet_stats.nodes_culled << "/" << packet_stats.nodes_visited << " nodes culled by interval test, "
+                  << packet_stats.scalar_fallbacks << " lanes fell back to scalar traversal\n";
+    }
+    if (use_wavefront) {
+        std::cout << "Wavefront: " << wavefront_stats.waves << " waves, "
+                  << wavefront_stats.camera_rays << " camera rays, "
+                  << wavefront_stats.secondary_rays << " secondary rays, "
+                  << wavefront_stats.shadow_rays << " shadow rays\n";
+        if (scene.use_bvh) {
+            const NodeCache& cache = wavefront_stats.secondary_node_cache;
+            std::cout << "Secondary rays" << (sort_secondary_rays ? " (sorted)" : " (unsorted)") << ": "
+                      << cache.accesses << " BVH node visits, "
+                      << 100.0 * cache.hit_rate() << "% hit a " << NodeCache::capacity << "-node LRU cache\n";
+        }
+    }
 
-    outfile.close();
-    
     return 0;
 }
@@ -0,0 +1,231 @@
+#include "progressive.h"
+#include "scene.h"
+#include "camera.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+
+void AccumulationBuffer::resize(int w, int h) {
+    width = w;
+    height = h;
+    passes = 0;
+    color_sum.assign(w * h, vector3(0.0, 0.0, 0.0));
+    luminance_sum.assign(w * h, 0.0);
+    luminance_sq_sum.assign(w * h, 0.0);
+    samples.assign(w * h, 0);
+}
+
+void AccumulationBuffer::resolve(std::vector<vector3>& framebuffer) const {
+    framebuffer.resize(color_sum.size());
+    for (size_t i = 0; i < color_sum.size(); ++i) {
+        framebuffer[i] = samples[i] > 0 ? color_sum[i] / samples[i] : vector3(0.0, 0.0, 0.0);
+    }
+}
+
+double AccumulationBuffer::pixel_noise(int index) const {
+    int n = samples[index];
+    if (n < 2) return INFINITY;
+    double mean = luminance_sum[index] / n;
+    double variance = std::max(0.0, (luminance_sq_sum[index] - n * mean * mean) / (n - 1));
+    return std::sqrt(variance / n);
+}
+
+double AccumulationBuffer::noise() const {
+    if (color_sum.empty()) return INFINITY;
+    double total = 0.0;
+    for (size_t i = 0; i < color_sum.size(); ++i) {
+        total += pixel_noise(i);
+    }
+    return total / color_sum.size();
+}
+
+const char* progressive_stop_name(ProgressiveStop stop) {
+    switch (stop) {
+        case ProgressiveStop::NoiseThreshold: return "noise threshold";
+        case ProgressiveStop::Interrupted: return "interrupt";
+        case ProgressiveStop::TargetSamples:
+        default: return "target samples";
+    }
+}
+
+static volatile std::sig_atomic_t interrupt_requested = 0;
+
+static void handle_interrupt(int) {
+    interrupt_requested = 1;
+}
+
+// Adds the pixel's next sample of the sampler sequence to the running sums
+static void add_sample(const Scene& scene, const Camera& camera, int nbounces, Sampler& sampler,
+                       AccumulationBuffer& accum, int x, int y) {
+    int index = y * accum.width + x;
+    sampler.start_pixel_sample(x, y, accum.samples[index]);
+    auto [dx, dy] = sampler.get_2d(); // sub-pixel position
+    auto [u, v] = jitter_pixel(x, y, dx, dy, accum.width, accum.height);
+    vector3 color = scene.shade(camera.get_ray(u, v), nbounces);
+
+    double luminance = 0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z;
+    accum.color_sum[index] += color;
+    accum.luminance_sum[index] += luminance;
+    accum.luminance_sq_sum[index] += luminance * luminance;
+    accum.samples[index]++;
+}
+
+// One sample per pixel, added to the running sums
+static void render_pass(const Scene& scene, const Camera& camera, int nbounces, const ProgressiveSettings& settings,
+                        AccumulationBuffer& accum) {
+    #pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < accum.height; ++y) {
+        auto sampler = make_sampler(settings.sampler, settings.max_passes);
+        active_sampler() = sampler.get();
+
+        for (int x = 0; x < accum.width; ++x) {
+            add_sample(scene, camera, nbounces, *sampler, accum, x, y);
+        }
+
+        active_sampler() = nullptr;
+    }
+}
+
+void render_progressive(const Scene& scene, const Camera& camera, int nbounces, const ProgressiveSettings& settings,
+                        AccumulationBuffer& accum, const std::function<void(const std::vector<vector3>&)>& snapshot,
+                        const std::function<void(const AccumulationBuffer&)>& checkpoint, ProgressiveStats& stats) {
+    interrupt_requested = 0;
+    auto previous_handler = std::signal(SIGINT, handle_interrupt);
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto last_snapshot = start;
+    auto last_checkpoint = start;
+    std::vector<vector3> image;
+
+    stats.stop = ProgressiveStop::TargetSamples;
+    while (accum.passes < settings.max_passes) {
+        if (interrupt_requested) {
+            stats.stop = ProgressiveStop::Interrupted;
+            break;
+        }
+
+        render_pass(scene, camera, nbounces, settings, accum);
+        accum.passes++;
+
+        auto now = clock::now();
+        bool pass_due = settings.snapshot_passes > 0 && accum.passes % settings.snapshot_passes == 0;
+        bool time_due = settings.snapshot_seconds > 0.0
+            && std::chrono::duration<double>(now - last_snapshot).count() >= settings.snapshot_seconds;
+        if (snapshot && (pass_due || time_due)) {
+            accum.resolve(image);
+            snapshot(image);
+            stats.snapshots++;
+            last_snapshot = now;
+        }
+        if (checkpoint && std::chrono::duration<double>(now - last_checkpoint).count() >= settings.checkpoint_seconds) {
+            checkpoint(accum);
+            stats.checkpoints++;
+            last_checkpoint = now;
+        }
+
+        if (settings.noise_threshold > 0.0 && accum.noise() < settings.noise_threshold) {
+            stats.stop = ProgressiveStop::NoiseThreshold;
+            break;
+        }
+    }
+
+    if (checkpoint) {
+        checkpoint(accum);
+        stats.checkpoints++;
+    }
+
+    stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    std::signal(SIGINT, previous_handler);
+}
+
+// Rectangle of pixels refined together by the time-budget renderer
+struct Tile {
+    int x0, y0, x1, y1;
+    double noise = 0.0;
+};
+
+void render_time_budget(const Scene& scene, const Camera& camera, int nbounces, double budget_seconds, SamplerType sampler_type,
+                        int tile_size, AccumulationBuffer& accum, TimeBudgetStats& stats) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < accum.height; y += tile_size) {
+        for (int x = 0; x < accum.width; x += tile_size) {
+            tiles.push_back({x, y, std::min(x + tile_size, accum.width), std::min(y + tile_size, accum.height)});
+        }
+    }
+
+    // The sample count per pixel is open-ended, so the stratified sampler gets a fixed 1024 strata and
+    // wraps around every 1024 samples: sample 1024 + k is jittered in the same stratum as sample k.
+    // Tiles stop at max_samples, independently of the strata
+    const int max_samples = 1 << 16;
+
+    // Tiles finished so far and the time each took on its own thread, summed over all threads, so the
+    // average is what the next tile will cost whichever thread takes it
+    std::atomic<long> tiles_rendered{0};
+    std::atomic<long long> tile_nanoseconds{0};
+    std::atomic<bool> out_of_time{false};
+    for (int round = 0; !out_of_time; ++round) {
+        if (round > 0) {
+            // Refine the noisiest tiles first, so an unfinished round went where it helps most
+            for (Tile& tile : tiles) {
+                tile.noise = 0.0;
+                for (int y = tile.y0; y < tile.y1; ++y) {
+                    for (int x = tile.x0; x < tile.x1; ++x) tile.noise += accum.pixel_noise(y * accum.width + x);
+                }
+            }
+            std::stable_sort(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b) { return a.noise > b.noise; });
+        }
+
+        #pragma omp parallel
+        {
+            auto sampler = make_sampler(sampler_type, 1024);
+            active_sampler() = sampler.get();
+
+            // Tiles write disjoint pixels. Once one thread finds the budget spent, the tiles not yet
+            // claimed are skipped
+            #pragma omp for schedule(dynamic)
+            for (size_t i = 0; i < tiles.size(); ++i) {
+                const Tile& tile = tiles[i];
+                if (out_of_time.load(std::memory_order_relaxed)) continue;
+
+                // The first round always completes so every pixel has a sample
+                long rendered = tiles_rendered.load(std::memory_order_relaxed);
+                double tile_time = rendered ? tile_nanoseconds.load(std::memory_order_relaxed) * 1e-9 / rendered : 0.0;
+                if ((round > 0 && elapsed() + tile_time > budget_seconds)
+                    || accum.samples[tile.y0 * accum.width + tile.x0] >= max_samples) {
+                    out_of_time.store(true, std::memory_order_relaxed);
+                    continue;
+                }
+
+                auto tile_start = clock::now();
+                for (int y = tile.y0; y < tile.y1; ++y) {
+                    for (int x = tile.x0; x < tile.x1; ++x) {
+                        add_sample(scene, camera, nbounces, *sampler, accum, x, y);
+                    }
+                }
+                tile_nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - tile_start).count(),
+                                           std::memory_order_relaxed);
+                tiles_rendered.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            active_sampler() = nullptr;
+        }
+        if (!out_of_time) accum.passes++;
+    }
+
+    stats.seconds = elapsed();
+    stats.min_samples = *std::min_element(accum.samples.begin(), accum.samples.end());
+    stats.max_samples = *std::max_element(accum.samples.begin(), accum.samples.end());
+    long total = 0;
+    for (int n : accum.samples) total += n;
+    stats.mean_samples = static_cast<double>(total) / accum.samples.size();
+    stats.rounds = accum.passes + (stats.min_samples < stats.max_samples ? 1 : 0);
+}
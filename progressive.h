@@ -0,0 +1,82 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "vector3.h"
+#include "sampler.h"
+
+class Scene;
+class Camera;
+
+// Running sums of every pixel over the samples rendered so far
+struct AccumulationBuffer {
+    int width = 0, height = 0;
+    int passes = 0;                        // complete passes over the image
+    std::vector<vector3> color_sum;
+    std::vector<double> luminance_sum;     // for the noise estimate
+    std::vector<double> luminance_sq_sum;
+    std::vector<int> samples;              // samples taken per pixel
+
+    void resize(int w, int h);
+
+    // Average colour per pixel
+    void resolve(std::vector<vector3>& framebuffer) const;
+
+    // Standard error of the mean luminance of one pixel (infinite below two samples)
+    double pixel_noise(int index) const;
+
+    // Mean over pixels of pixel_noise
+    double noise() const;
+};
+
+struct ProgressiveSettings {
+    int max_passes = 1024;          // target samples per pixel
+    int snapshot_passes = 0;        // snapshot every N passes (0 = off)
+    double snapshot_seconds = 0.0;  // snapshot every N seconds (0 = off)
+    double noise_threshold = 0.0;   // stop once AccumulationBuffer::noise() is below (0 = off)
+    double checkpoint_seconds = 60.0; // checkpoint interval when a checkpoint callback is given
+    SamplerType sampler = SamplerType::Sobol;
+};
+
+enum class ProgressiveStop {
+    TargetSamples,
+    NoiseThreshold,
+    Interrupted
+};
+
+struct ProgressiveStats {
+    double seconds = 0.0;
+    int snapshots = 0;
+    int checkpoints = 0;
+    ProgressiveStop stop = ProgressiveStop::TargetSamples;
+};
+
+const char* progressive_stop_name(ProgressiveStop stop);
+
+struct TimeBudgetStats {
+    double seconds = 0.0;
+    int rounds = 0;           // rounds over the tiles, the first of which covers the whole image
+    int min_samples = 0, max_samples = 0;
+    double mean_samples = 0.0;
+};
+
+// Adds 1-spp passes to `accum` until a stop condition holds or SIGINT arrives; an interrupt lets the
+// current pass finish so the buffer never holds a partial pass. Pass p of pixel (x, y) is sample p
+// of the sampler, so passes keep refining the same sample sequence. `snapshot` receives the resolved
+// image whenever a snapshot is due. `checkpoint` receives the buffer between passes whenever a
+// checkpoint is due and once more when rendering stops. A buffer that already holds passes (e.g. a
+// resumed checkpoint) is continued, with `max_passes` counting them too
+void render_progressive(const Scene& scene, const Camera& camera, int nbounces, const ProgressiveSettings& settings,
+                        AccumulationBuffer& accum, const std::function<void(const std::vector<vector3>&)>& snapshot,
+                        const std::function<void(const AccumulationBuffer&)>& checkpoint, ProgressiveStats& stats);
+
+// Deadline rendering: one sample for every pixel first, so the image is always complete, then rounds
+// of one more sample per pixel, tile by tile, noisiest tiles first. The tiles of a round are spread over
+// threads, each with its own sampler. A tile is only started when the average tile time still fits
+// before `budget_seconds`, so the render stops refining cleanly
+void render_time_budget(const Scene& scene, const Camera& camera, int nbounces, double budget_seconds, SamplerType sampler,
+                        int tile_size, AccumulationBuffer& accum, TimeBudgetStats& stats);
+
+#endif
@@ -2,6 +2,7 @@
 #define RAY_H
 
 #include "vector3.h"
+#include "vector3_packet.h"
 
 class ray {
 public:
@@ -17,4 +18,22 @@ public:
     vector3 get_origin() const { return origin; }
 };
 
+// N coherent rays in SoA layout, with the reciprocal direction cached for slab tests
+template <int N>
+class ray_packet {
+public:
+    vector3xN<N> origin;
+    vector3xN<N> direction;
+    vector3xN<N> inv_direction;
+
+    ray_packet() {}
+    ray_packet(const vector3xN<N>& origin, const vector3xN<N>& direction)
+        : origin(origin), direction(direction),
+          inv_direction(1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z) {}
+
+    vector3xN<N> at(const doublexN<N>& t) const { return origin + direction * t; }
+
+    ray get(int i) const { return ray(origin.get(i), direction.get(i)); }
+};
+
 #endif
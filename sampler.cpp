@@ -0,0 +1,362 @@
+#include "sampler.h"
+#include "scene.h"
+#include "camera.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+/* --------------- Hashing helpers --------------- */
+
+static uint32_t mix_bits(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t hash(uint32_t a, uint32_t b, uint32_t c) {
+    return mix_bits(a ^ mix_bits(b ^ mix_bits(c + 0x9e3779b9u)));
+}
+
+// Maps 32 random bits to [0, 1)
+static double to_unit(uint32_t bits) {
+    return bits * (1.0 / 4294967296.0);
+}
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Random permutation of [0, l) evaluated one element at a time (Kensler, "Correlated Multi-Jittered Sampling")
+static uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do {
+        i ^= p; i *= 0xe170893du; i ^= p >> 16;
+        i ^= (i & w) >> 4; i ^= p >> 8; i *= 0x0929eb3fu; i ^= p >> 23;
+        i ^= (i & w) >> 1; i *= 1 | p >> 27; i *= 0x6935fa69u;
+        i ^= (i & w) >> 11; i *= 0x74dcb303u;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+        i &= w; i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// Hash-based Owen scrambling of a base-2 fraction (Burley, "Practical Hash-based Owen Scrambling")
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverse_bits(x);
+}
+
+/* --------------- Samplers --------------- */
+
+// White noise hashed from the pixel, sample index and dimension rather than drawn from a generator, so
+// a sample's numbers don't depend on which thread takes it or on what was drawn before
+class RandomSampler : public Sampler {
+public:
+    double get_1d() override {
+        return to_unit(hash(hash(px, py, sample_index), dimension++, 0x52414e44u));
+    }
+
+    std::pair<double, double> get_2d() override {
+        double u = get_1d();
+        double v = get_1d();
+        return { u, v };
+    }
+};
+
+class StratifiedSampler : public Sampler {
+public:
+    explicit StratifiedSampler(int samples_per_pixel) : samples(std::max(1, samples_per_pixel)) {}
+
+    double get_1d() override {
+        uint32_t seed = hash(px, py, dimension++);
+        uint32_t stratum = permute(sample_index % samples, samples, seed);
+        return (stratum + to_unit(hash(seed, sample_index, 1))) / samples;
+    }
+
+    // Equal-area cells in rows about sqrt(samples) apart, like the stratified area-light sampling
+    std::pair<double, double> get_2d() override {
+        uint32_t seed = hash(px, py, dimension);
+        dimension += 2;
+        int i = permute(sample_index % samples, samples, seed);
+
+        int rows = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(samples))));
+        int row = 0;
+        while ((row + 1) * samples / rows <= i) ++row;
+        int begin = row * samples / rows;
+        int cells = (row + 1) * samples / rows - begin;
+
+        double u = (i - begin + to_unit(hash(seed, sample_index, 1))) / cells;
+        double v = (begin + to_unit(hash(seed, sample_index, 2)) * cells) / samples;
+        return { u, v };
+    }
+
+private:
+    int samples;
+};
+
+class HaltonSampler : public Sampler {
+public:
+    double get_1d() override {
+        int d = dimension++;
+        return sample(d);
+    }
+
+    std::pair<double, double> get_2d() override {
+        int d = dimension;
+        dimension += 2;
+        return { sample(d), sample(d + 1) };
+    }
+
+private:
+    double sample(int d) const {
+        static const int primes[] = {
+            2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+            59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+        };
+        const int num_primes = sizeof(primes) / sizeof(primes[0]);
+
+        // Dimensions beyond the prime table reuse the bases with a different rotation
+        double value = radical_inverse(primes[d % num_primes], sample_index) + to_unit(hash(px, py, d));
+        return value - std::floor(value);
+    }
+
+    static double radical_inverse(int base, uint32_t index) {
+        double inv_base = 1.0 / base, factor = inv_base, result = 0.0;
+        while (index > 0) {
+            result += (index % base) * factor;
+            index /= base;
+            factor *= inv_base;
+        }
+        return result;
+    }
+};
+
+class SobolSampler : public Sampler {
+public:
+    double get_1d() override {
+        uint32_t seed = hash(px, py, dimension++);
+        uint32_t index = nested_uniform_scramble(sample_index, seed);
+        return to_unit(nested_uniform_scramble(reverse_bits(index), hash(seed, 1, 0)));
+    }
+
+    // Each pair of dimensions is the first two Sobol dimensions, shuffled and scrambled with its own seed
+    std::pair<double, double> get_2d() override {
+        uint32_t seed = hash(px, py, dimension);
+        dimension += 2;
+        uint32_t index = nested_uniform_scramble(sample_index, seed);
+
+        uint32_t x = reverse_bits(index);
+        uint32_t y = 0;
+        for (uint32_t v = 1u << 31, i = index; i; i >>= 1, v ^= v >> 1) {
+            if (i & 1) y ^= v;
+        }
+        return { to_unit(nested_uniform_scramble(x, hash(seed, 1, 0))),
+                 to_unit(nested_uniform_scramble(y, hash(seed, 2, 0))) };
+    }
+};
+
+// Ranks of a toroidal blue-noise mask made with Ulichney's void-and-cluster method
+class BlueNoiseMask {
+public:
+    static const int size = 64;
+
+    BlueNoiseMask() {
+        const int n = size * size;
+        const double sigma = 1.5;
+
+        // Gaussian energy kernel over toroidal offsets
+        std::vector<double> kernel(n);
+        for (int dy = 0; dy < size; ++dy) {
+            for (int dx = 0; dx < size; ++dx) {
+                int wx = std::min(dx, size - dx), wy = std::min(dy, size - dy);
+                kernel[dy * size + dx] = std::exp(-(wx * wx + wy * wy) / (2.0 * sigma * sigma));
+            }
+        }
+
+        std::vector<char> pattern(n, 0);
+        std::vector<double> energy(n, 0.0);
+        auto toggle = [&](int p, bool on) {
+            pattern[p] = on;
+            int px = p % size, py = p / size;
+            double sign = on ? 1.0 : -1.0;
+            for (int y = 0; y < size; ++y) {
+                for (int x = 0; x < size; ++x) {
+                    energy[y * size + x] += sign * kernel[((y - py + size) % size) * size + (x - px + size) % size];
+                }
+            }
+        };
+        auto tightest_cluster = [&]() {
+            int best = -1;
+            for (int p = 0; p < n; ++p) if (pattern[p] && (best < 0 || energy[p] > energy[best])) best = p;
+            return best;
+        };
+        auto largest_void = [&]() {
+            int best = -1;
+            for (int p = 0; p < n; ++p) if (!pattern[p] && (best < 0 || energy[p] < energy[best])) best = p;
+            return best;
+        };
+
+        // Initial pattern: 10% random points relaxed until moving the tightest cluster no longer helps
+        std::mt19937 gen(1234);
+        int initial = n / 10;
+        for (int placed = 0; placed < initial;) {
+            int p = gen() % n;
+            if (!pattern[p]) { toggle(p, true); ++placed; }
+        }
+        for (int iteration = 0; iteration < n; ++iteration) {
+            int cluster = tightest_cluster();
+            toggle(cluster, false);
+            int hole = largest_void();
+            toggle(hole, true);
+            if (hole == cluster) break;
+        }
+        std::vector<char> initial_pattern = pattern;
+        std::vector<double> initial_energy = energy;
+
+        ranks.assign(n, 0);
+
+        // Ranks below the initial count: remove the tightest clusters
+        for (int rank = initial - 1; rank >= 0; --rank) {
+            int cluster = tightest_cluster();
+            toggle(cluster, false);
+            ranks[cluster] = rank;
+        }
+
+        // Ranks above it: fill the largest voids
+        pattern = initial_pattern;
+        energy = initial_energy;
+        for (int rank = initial; rank < n; ++rank) {
+            int hole = largest_void();
+            toggle(hole, true);
+            ranks[hole] = rank;
+        }
+    }
+
+    double value(int x, int y) const {
+        x &= size - 1;
+        y &= size - 1;
+        return (ranks[y * size + x] + 0.5) / (size * size);
+    }
+
+private:
+    std::vector<int> ranks;
+};
+
+// Rank-1 lattice sequences (golden ratio in 1D, Roberts' R2 in 2D) offset per pixel by the blue-noise
+// mask, so neighbouring pixels get well-spread offsets at every sample count
+class BlueNoiseSampler : public Sampler {
+public:
+    double get_1d() override {
+        double offset = mask_value(dimension++);
+        double value = offset + sample_index * 0.6180339887498949;
+        return value - std::floor(value);
+    }
+
+    std::pair<double, double> get_2d() override {
+        double offset_u = mask_value(dimension);
+        double offset_v = mask_value(dimension + 1);
+        dimension += 2;
+        double u = offset_u + sample_index * 0.7548776662466927;
+        double v = offset_v + sample_index * 0.5698402909980532;
+        return { u - std::floor(u), v - std::floor(v) };
+    }
+
+private:
+    // Each dimension reads the mask at its own toroidal shift so dimensions stay decorrelated
+    double mask_value(int d) const {
+        static const BlueNoiseMask mask;
+        uint32_t shift = hash(d, 0, 7);
+        return mask.value(px + (shift & 63), py + ((shift >> 6) & 63));
+    }
+};
+
+/* --------------- Interface --------------- */
+
+std::unique_ptr<Sampler> make_sampler(SamplerType type, int samples_per_pixel) {
+    switch (type) {
+        case SamplerType::Stratified: return std::make_unique<StratifiedSampler>(samples_per_pixel);
+        case SamplerType::Halton: return std::make_unique<HaltonSampler>();
+        case SamplerType::Sobol: return std::make_unique<SobolSampler>();
+        case SamplerType::BlueNoise: return std::make_unique<BlueNoiseSampler>();
+        case SamplerType::Random:
+        default: return std::make_unique<RandomSampler>();
+    }
+}
+
+bool parse_sampler_type(const std::string& name, SamplerType& type) {
+    if (name == "random") type = SamplerType::Random;
+    else if (name == "stratified") type = SamplerType::Stratified;
+    else if (name == "halton") type = SamplerType::Halton;
+    else if (name == "sobol") type = SamplerType::Sobol;
+    else if (name == "blue-noise") type = SamplerType::BlueNoise;
+    else return false;
+    return true;
+}
+
+const char* sampler_name(SamplerType type) {
+    switch (type) {
+        case SamplerType::Stratified: return "stratified";
+        case SamplerType::Halton: return "halton";
+        case SamplerType::Sobol: return "sobol";
+        case SamplerType::BlueNoise: return "blue-noise";
+        case SamplerType::Random:
+        default: return "random";
+    }
+}
+
+Sampler*& active_sampler() {
+    static thread_local Sampler* sampler = nullptr;
+    return sampler;
+}
+
+double sample_1d() {
+    Sampler* sampler = active_sampler();
+    return sampler ? sampler->get_1d() : random_double(0.0, 1.0);
+}
+
+std::pair<double, double> sample_2d() {
+    Sampler* sampler = active_sampler();
+    if (sampler) return sampler->get_2d();
+    double u = random_double(0.0, 1.0);
+    double v = random_double(0.0, 1.0);
+    return { u, v };
+}
+
+void render_sampled(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces,
+                    SamplerType type, int samples_per_pixel, std::vector<vector3>& framebuffer) {
+    #pragma omp parallel for schedule(dynamic)
+    for (int y = 0; y < image_height; ++y) {
+        auto sampler = make_sampler(type, samples_per_pixel);
+        active_sampler() = sampler.get();
+
+        for (int x = 0; x < image_width; ++x) {
+            vector3 pixel_color(0.0, 0.0, 0.0);
+            for (int s = 0; s < samples_per_pixel; ++s) {
+                sampler->start_pixel_sample(x, y, s);
+                auto [dx, dy] = sampler->get_2d(); // sub-pixel position
+                auto [u, v] = jitter_pixel(x, y, dx, dy, image_width, image_height);
+                pixel_color += scene.shade(camera.get_ray(u, v), nbounces);
+            }
+            framebuffer[y * image_width + x] = pixel_color / samples_per_pixel;
+        }
+
+        active_sampler() = nullptr;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "vector3.h"
+
+class Scene;
+class Camera;
+
+enum class SamplerType {
+    Random,      // independent uniform numbers, hashed per pixel, sample and dimension
+    Stratified,  // one jittered cell per sample, cells shuffled per pixel and dimension
+    Halton,      // Halton sequence, Cranley-Patterson rotated per pixel
+    Sobol,       // (0,2)-sequence pairs with Owen scrambling and per-pixel shuffling
+    BlueNoise    // R2 sequence offset by a void-and-cluster blue-noise mask
+};
+
+// Hands out the sample values for one pixel sample, dimension after dimension. Every call to get_1d/get_2d
+// consumes the next dimension, so the AA jitter, each bounce and each light sample get their own
+// decorrelated dimensions as long as the tracer draws them in a fixed order
+class Sampler {
+public:
+    virtual ~Sampler() = default;
+
+    // Starts sample `index` (of samples_per_pixel) of pixel (x, y) and rewinds to the first dimension
+    virtual void start_pixel_sample(int x, int y, int index) {
+        px = x;
+        py = y;
+        sample_index = index;
+        dimension = 0;
+    }
+
+    virtual double get_1d() = 0;
+    virtual std::pair<double, double> get_2d() = 0;
+
+protected:
+    int px = 0, py = 0;
+    int sample_index = 0;
+    int dimension = 0;
+};
+
+std::unique_ptr<Sampler> make_sampler(SamplerType type, int samples_per_pixel);
+
+// Parses "random", "stratified", "halton", "sobol" or "blue-noise"; returns false for anything else
+bool parse_sampler_type(const std::string& name, SamplerType& type);
+
+const char* sampler_name(SamplerType type);
+
+// The sampler driving the sample traced on this thread. Shading code draws its random numbers through
+// sample_1d/sample_2d, which fall back to random_double when no sampler is active
+Sampler*& active_sampler();
+
+double sample_1d();
+std::pair<double, double> sample_2d();
+
+// `samples_per_pixel` samples per pixel with the sub-pixel jitter and all shading dimensions taken
+// from a sampler of the given type
+void render_sampled(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces,
+                    SamplerType type, int samples_per_pixel, std::vector<vector3>& framebuffer);
+
+#endif
@@ -1,5 +1,9 @@
 #include "scene.h"
 #include "utils.h"
+#include "sampler.h"
+#include "aov.h"
+
+#include <cmath>
 
 // Helper function to parse materials
 Material parse_material(const nlohmann::json& material_json) {
@@ -43,6 +47,9 @@ void Scene::load_from_json(const nlohmann::json& scene_json) {
                 light.v = vector3(light_data["v"][0], light_data["v"][1], light_data["v"][2]).unit();
                 light.width = light_data["width"];
                 light.height = light_data["height"];
+                if (light_data.contains("samples")) {
+                    light.samples = light_data["samples"];
+                }
             }
 
             add_light(light);
@@ -97,6 +104,43 @@ void Scene::load_from_json(const nlohmann::json& scene_json) {
     }
 }
 
+std::atomic<long> Scene::next_id{0};
+
+ShadingThreadState& Scene::thread_state() const {
+    // The state this thread last used, and the scene it belongs to. Only switching scenes takes the lock
+    static thread_local long current_scene = -1;
+    static thread_local ShadingThreadState* current = nullptr;
+    if (current_scene == id) return *current;
+
+    std::lock_guard<std::mutex> lock(thread_states_mutex);
+    const std::thread::id self = std::this_thread::get_id();
+    current = nullptr;
+    for (const auto& state : thread_states) {
+        if (state->owner == self) current = state.get();
+    }
+    if (!current) {
+        thread_states.push_back(std::make_unique<ShadingThreadState>());
+        current = thread_states.back().get();
+        current->owner = self;
+    }
+    current_scene = id;
+    return *current;
+}
+
+ShadingStats Scene::shading_stats() const {
+    std::lock_guard<std::mutex> lock(thread_states_mutex);
+    ShadingStats total;
+    for (const auto& state : thread_states) total.merge(state->shading);
+    return total;
+}
+
+ShadowStats Scene::shadow_stats() const {
+    std::lock_guard<std::mutex> lock(thread_states_mutex);
+    ShadowStats total;
+    for (const auto& state : thread_states) total.merge(state->shadow);
+    return total;
+}
+
 // Iterates over all shapes in the scene and checks for intersections with the given ray.
 bool Scene::brute_force_intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t) const {
     bool hit = false;
@@ -114,6 +158,30 @@ bool Scene::brute_force_intersects(const ray& r, double& t_hit, std::shared_ptr<
 }
 
 
+template <int N>
+maskxN<N> Scene::intersects(const ray_packet<N>& r, const maskxN<N>& active, doublexN<N>& t_hit, const Shape* hit_shapes[], double max_t, PacketStats& stats) const {
+    if (use_bvh) {
+        return bvh->intersects(r, active, t_hit, hit_shapes, max_t, stats);
+    }
+
+    // Brute force, but still one packet test per shape
+    t_hit = doublexN<N>(max_t);
+    for (int i = 0; i < N; ++i) hit_shapes[i] = nullptr;
+    maskxN<N> hit;
+    for (const auto& shape : shapes) {
+        doublexN<N> t = t_hit;
+        maskxN<N> shape_hit = intersects_packet(*shape, r, t, active);
+        maskxN<N> closer = shape_hit & (t < t_hit) & (t > doublexN<N>(1e-4));
+        t_hit = select(closer, t, t_hit);
+        for (int i = 0; i < N; ++i) {
+            if (closer[i]) hit_shapes[i] = shape.get();
+        }
+        hit = hit | closer;
+    }
+    return hit;
+}
+
+
 /* --------------- Shading / reflection / refraction functions --------------- */
 
 vector3 Scene::shade(
@@ -125,12 +193,48 @@ vector3 Scene::shade(
         case RenderMode::Binary:
             return shade_binary(r);
         case RenderMode::BlinnPhong:
-            return shade_blinn_phong(r, nbounces);
+            return use_iterative ? shade_iterative(r, nbounces) : shade_blinn_phong(r, nbounces);
         default:
             throw std::runtime_error("Unsupported render mode.");
     }
 }
 
+template <int N>
+void Scene::shade(
+    const ray_packet<N>& r,
+    const maskxN<N>& active,
+    int nbounces,
+    vector3 colors[],
+    PacketStats& stats
+) const {
+    doublexN<N> t_hit;
+    const Shape* hit_shapes[N];
+    maskxN<N> hit = intersects(r, active, t_hit, hit_shapes, std::numeric_limits<double>::max(), stats);
+
+    for (int i = 0; i < N; ++i) {
+        if (!active[i]) continue;
+
+        if (render_mode == RenderMode::Binary) {
+            colors[i] = hit[i] ? vector3(1.0, 0.0, 0.0) : vector3(0.0, 0.0, 0.0);
+        } else if (!hit[i]) {
+            colors[i] = backgroundcolor;
+        } else {
+            ray lane = r.get(i);
+            vector3 hit_point = lane.origin + t_hit[i] * lane.direction;
+            vector3 normal = hit_shapes[i]->get_normal(hit_point);
+            colors[i] = use_iterative
+                ? shade_surface_iterative(lane, hit_point, normal, *hit_shapes[i], nbounces)
+                : shade_surface(lane, hit_point, normal, hit_shapes[i]->material, *hit_shapes[i], nbounces);
+        }
+    }
+}
+
+// Packet sizes used by the 4x4 and 8x8 tile tracers
+template void Scene::shade<16>(const ray_packet<16>&, const maskxN<16>&, int, vector3[], PacketStats&) const;
+template void Scene::shade<64>(const ray_packet<64>&, const maskxN<64>&, int, vector3[], PacketStats&) const;
+template maskxN<16> Scene::intersects<16>(const ray_packet<16>&, const maskxN<16>&, doublexN<16>&, const Shape*[], double, PacketStats&) const;
+template maskxN<64> Scene::intersects<64>(const ray_packet<64>&, const maskxN<64>&, doublexN<64>&, const Shape*[], double, PacketStats&) const;
+
 // Only returns red or black
 vector3 Scene::shade_binary(const ray& r) const {
     double t_hit;
@@ -151,9 +255,17 @@ vector3 Scene::shade_blinn_phong(const ray& r, int nbounces) const {
 
     vector3 hit_point = r.origin + t_hit * r.direction;
     vector3 normal = hit_shape->get_normal(hit_point);
+    record_aov_depth(r, t_hit);
     return shade_surface(r, hit_point, normal, hit_shape->material, *hit_shape, nbounces);
 }
 
+// The depth AOV comes from the entry points, which are the only ones that know the hit distance;
+// compute_blinn_phong marks the sample as hit right after, so secondary rays don't overwrite it
+void Scene::record_aov_depth(const ray& r, double t_hit) const {
+    AOVSample* aov = active_aov();
+    if (aov && !aov->hit) aov->depth = t_hit * r.direction.length();
+}
+
 // Computes the colour of the surface at the intersection point by combining local, reflection, and refraction colours
 vector3 Scene::shade_surface(
     const ray& r,
@@ -167,16 +279,178 @@ vector3 Scene::shade_surface(
 
     vector3 local_color = compute_blinn_phong(hit_point, normal, view_dir, material, shape);
 
-    vector3 reflection_color = compute_reflection(r, hit_point, normal, material, nbounces - 1);
+    vector3 reflection_color(0.0, 0.0, 0.0);
+    vector3 refraction_color(0.0, 0.0, 0.0);
 
-    vector3 refraction_color = material.isrefractive
-        ? compute_refraction(r, hit_point, normal, material, nbounces - 1)
-        : vector3(0.0, 0.0, 0.0);
+    ray refracted(hit_point, normal);
+    if (stochastic_fresnel && material.isreflective && material.isrefractive
+        && refract_ray(r, hit_point, normal, material, refracted)) {
+        double weight;
+        if (choose_reflection(r, normal, material, weight)) {
+            reflection_color = compute_reflection(r, hit_point, normal, material, nbounces - 1) * weight;
+        } else {
+            refraction_color = compute_refraction(r, hit_point, normal, material, nbounces - 1) * weight;
+        }
+    } else {
+        reflection_color = compute_reflection(r, hit_point, normal, material, nbounces - 1);
+
+        if (material.isrefractive) {
+            refraction_color = compute_refraction(r, hit_point, normal, material, nbounces - 1);
+        }
+    }
 
     // Combine components
     return local_color + reflection_color + refraction_color;
 }
 
+// Iterative counterpart of shade_blinn_phong
+vector3 Scene::shade_iterative(const ray& r, int nbounces) const {
+    double t_hit;
+    std::shared_ptr<Shape> hit_shape;
+    if (!intersects(r, t_hit, hit_shape, std::numeric_limits<double>::max())) {
+        return backgroundcolor;
+    }
+
+    vector3 hit_point = r.origin + t_hit * r.direction;
+    vector3 normal = hit_shape->get_normal(hit_point);
+    record_aov_depth(r, t_hit);
+    return shade_surface_iterative(r, hit_point, normal, *hit_shape, nbounces);
+}
+
+// Depth-first walk of the ray tree. Children are popped reflection first, like the recursive
+// version, so area-light samples are drawn in the same order
+vector3 Scene::shade_surface_iterative(
+    const ray& r,
+    const vector3& hit_point,
+    const vector3& normal,
+    const Shape& shape,
+    int nbounces
+) const {
+    // Scratch space reused across calls; never re-entered on the same thread
+    static thread_local std::vector<RayTask> stack;
+    stack.clear();
+
+    vector3 color = shade_task({r, vector3(1.0, 1.0, 1.0), nbounces}, hit_point, normal, shape, stack);
+
+    while (!stack.empty()) {
+        RayTask task = stack.back();
+        stack.pop_back();
+
+        double t_hit;
+        std::shared_ptr<Shape> hit_shape;
+        if (!intersects(task.r, t_hit, hit_shape, std::numeric_limits<double>::max())) {
+            color += task.throughput * backgroundcolor;
+            continue;
+        }
+
+        vector3 task_hit = task.r.origin + t_hit * task.r.direction;
+        color += shade_task(task, task_hit, hit_shape->get_normal(task_hit), *hit_shape, stack);
+    }
+
+    return color;
+}
+
+vector3 Scene::shade_task(
+    const RayTask& task,
+    const vector3& hit_point,
+    const vector3& normal,
+    const Shape& shape,
+    std::vector<RayTask>& stack
+) const {
+    const Material& material = shape.material;
+    vector3 view_dir = -task.r.direction.unit();
+    vector3 local_color = compute_blinn_phong(hit_point, normal, view_dir, material, shape);
+
+    // Same depth rules as compute_reflection/compute_refraction: children are traced at nbounces - 2
+    if (task.depth - 1 > 0) {
+        ray refracted(hit_point, normal);
+        bool refracts = material.isrefractive && refract_ray(task.r, hit_point, normal, material, refracted);
+        bool reflects = material.isreflective;
+        double refract_weight = material.transparency;
+        double reflect_weight = material.reflectivity;
+
+        if (stochastic_fresnel && reflects && refracts) {
+            double weight;
+            if (choose_reflection(task.r, normal, material, weight)) {
+                refracts = false;
+                reflect_weight *= weight;
+            } else {
+                reflects = false;
+                refract_weight *= weight;
+            }
+        }
+
+        if (refracts) {
+            vector3 throughput = task.throughput * refract_weight;
+            if (keep_ray(throughput)) {
+                stack.push_back({refracted, throughput, task.depth - 2});
+            }
+        }
+        if (reflects) {
+            vector3 throughput = task.throughput * reflect_weight;
+            if (keep_ray(throughput)) {
+                stack.push_back({reflect_ray(task.r, hit_point, normal), throughput, task.depth - 2});
+            }
+        }
+    }
+
+    return task.throughput * local_color;
+}
+
+double Scene::fresnel_schlick(const ray& r, const vector3& normal, const Material& material) const {
+    double cos_i = -normal.dot(r.direction.unit());
+    double n1 = 1.0, n2 = material.refractiveindex;
+    if (cos_i < 0.0) {
+        // Leaving the object
+        cos_i = -cos_i;
+        std::swap(n1, n2);
+    }
+
+    // Going into the less dense medium the cosine on the transmitted side is the one to use
+    double cos_theta = cos_i;
+    if (n1 > n2) {
+        double sin2_t = (n1 / n2) * (n1 / n2) * (1.0 - cos_i * cos_i);
+        if (sin2_t > 1.0) return 1.0;
+        cos_theta = std::sqrt(1.0 - sin2_t);
+    }
+
+    double r0 = (n1 - n2) / (n1 + n2);
+    r0 = r0 * r0;
+    return r0 + (1.0 - r0) * std::pow(1.0 - cos_theta, 5);
+}
+
+bool Scene::choose_reflection(const ray& r, const vector3& normal, const Material& material, double& weight) const {
+    // Keep both branches reachable so their weights stay bounded
+    double p = std::min(std::max(fresnel_schlick(r, normal, material), 0.1), 0.9);
+    if (sample_1d() < p) {
+        weight = 1.0 / p;
+        return true;
+    }
+    weight = 1.0 / (1.0 - p);
+    return false;
+}
+
+bool Scene::keep_ray(vector3& throughput) const {
+    ShadingStats& stats = thread_state().shading;
+    stats.rays_spawned++;
+
+    double peak = std::max({throughput.x, throughput.y, throughput.z});
+    if (peak < min_throughput) {
+        stats.rays_pruned++;
+        return false;
+    }
+
+    if (russian_roulette && peak < roulette_threshold) {
+        double survival = peak / roulette_threshold;
+        if (sample_1d() >= survival) {
+            stats.rays_terminated++;
+            return false;
+        }
+        throughput = throughput / survival;
+    }
+    return true;
+}
+
 // Uses light sources to compute the colour for a given point on the surface of a given shape
 vector3 Scene::compute_blinn_phong(
     const vector3& point,
@@ -185,66 +459,313 @@ vector3 Scene::compute_blinn_phong(
     const Material& material,
     const Shape& shape
 ) const {
-    vector3 color(0.0, 0.0, 0.0);
-
     auto uv = shape.get_uv(point);
     vector3 texture_color = material.texture
         ? material.texture->get_color_at_uv(uv.first, uv.second)
         : material.diffusecolor;
 
+    // Scratch space reused across calls; shading never re-enters this function on the same thread
+    static thread_local std::vector<LightSample> samples;
+    static thread_local std::vector<LightPick> picks;
+    picks.clear();
+    select_lights(point, normal, picks);
+
+    // First surface of a camera ray with AOVs requested: record it, with each light's share
+    AOVSample* aov = active_aov();
+    if (aov && aov->hit) aov = nullptr;
+    if (aov) {
+        aov->hit = true;
+        aov->normal = normal;
+        aov->albedo = texture_color;
+    }
+
+    vector3 color(0.0, 0.0, 0.0);
+    for (const auto& pick : picks) {
+        const Light& light = *pick.light;
+        vector3* light_aov = aov ? &aov->light[&light - lights.data()] : nullptr;
+        if (light.type == LightType::Area && adaptive_shadows) {
+            vector3 light_color = pick.weight * shade_area_light_adaptive(light, point, normal, view_dir, material, texture_color);
+            color += light_color;
+            if (light_aov) *light_aov += light_color;
+            continue;
+        }
+
+        samples.clear();
+        sample_light(light, point, normal, view_dir, material, texture_color, samples);
+        for (const auto& sample : samples) {
+            double shadow_factor = compute_shadow_factor(point, sample.position, sample.light);
+            vector3 sample_color = pick.weight * (shadow_factor * sample.contribution);
+            color += sample_color;
+            if (light_aov) *light_aov += sample_color;
+        }
+    }
+
+    return color;
+}
+
+void Scene::select_lights(const vector3& point, const vector3& normal, std::vector<LightPick>& picks) const {
+    if (light_bvh) {
+        for (int i = 0; i < light_picks; ++i) {
+            double pmf;
+            int index = light_bvh->sample(point, normal, light_cutoff, pmf);
+            if (index >= 0) {
+                picks.push_back({&lights[index], 1.0 / (light_picks * pmf)});
+            }
+        }
+        return;
+    }
+
     for (const auto& light : lights) {
-        if (light.type == LightType::Point) {
-            vector3 light_dir = (light.position - point).unit();
-            vector3 half_vector = (view_dir + light_dir).unit();
+        if (light_cutoff > 0.0 && LightBVH::importance(LightBVH::light_bounds(light), LightBVH::light_power(light),
+                                                       point, normal, light_cutoff) <= 0.0) {
+            continue;
+        }
+        picks.push_back({&light, 1.0});
+    }
+}
 
-            double diff = std::max(0.0, normal.dot(light_dir));
-            vector3 diffuse = material.kd * diff * texture_color * light.intensity;
+// Lists every shadow-ray target at a shading point together with the unshadowed diffuse + specular it delivers
+void Scene::sample_lights(
+    const vector3& point,
+    const vector3& normal,
+    const vector3& view_dir,
+    const Material& material,
+    const Shape& shape,
+    std::vector<LightSample>& samples
+) const {
+    auto uv = shape.get_uv(point);
+    vector3 texture_color = material.texture
+        ? material.texture->get_color_at_uv(uv.first, uv.second)
+        : material.diffusecolor;
 
-            double spec = std::pow(std::max(0.0, normal.dot(half_vector)), material.specularexponent);
-            vector3 specular = material.ks * spec * material.specularcolor * light.intensity;
+    static thread_local std::vector<LightPick> picks;
+    picks.clear();
+    select_lights(point, normal, picks);
 
-            double shadow_factor = compute_shadow_factor(point, light.position);
+    for (const auto& pick : picks) {
+        size_t first = samples.size();
+        sample_light(*pick.light, point, normal, view_dir, material, texture_color, samples);
+        if (pick.weight != 1.0) {
+            for (size_t i = first; i < samples.size(); ++i) samples[i].contribution = pick.weight * samples[i].contribution;
+        }
+    }
+}
 
-            color += shadow_factor * (diffuse + specular);
+// Jittered point in cell i of n equal-area cells tiling the unit square. Rows are about sqrt(n) apart,
+// and a row holding fewer cells is made taller so every cell still covers 1/n of the square
+static std::pair<double, double> jittered_sample(int i, int n) {
+    int rows = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(n))));
+    int row = 0;
+    while ((row + 1) * n / rows <= i) ++row;
+
+    int begin = row * n / rows;
+    int cells = (row + 1) * n / rows - begin;
+    auto [jitter_s, jitter_t] = sample_2d();
+    double s = (i - begin + jitter_s) / cells;
+    double t = (begin + jitter_t * cells) / n;
+    return { s, t };
+}
 
-        } else if (light.type == LightType::Area) {
-            int num_samples = 32;
-            vector3 area_color(0.0, 0.0, 0.0);
+// Projection of a rectangular light onto the unit sphere around a shading point, sampled uniformly
+// by solid angle (Urena, Fajardo and King, "An Area-Preserving Parametrization for Spherical Rectangles")
+struct SphericalRectangle {
+    vector3 origin, x, y, z;
+    double x0, y0, z0, x1, y1;
+    double b0, b1, k;
+    double solid_angle = 0.0;
+
+    // Returns false when the point sees the rectangle edge-on and there is nothing to sample
+    bool init(const Light& light, const vector3& point) {
+        origin = point;
+        x = light.u;
+        y = light.v;
+        z = x.cross(y);
+
+        vector3 d = light.position - point;
+        z0 = d.dot(z);
+        if (z0 > 0.0) {
+            z = -z;
+            z0 = -z0;
+        }
+        x0 = d.dot(x);
+        y0 = d.dot(y);
+        x1 = x0 + light.width;
+        y1 = y0 + light.height;
+        if (std::abs(z0) < 1e-9) return false;
+
+        // Normals of the planes through the point and each edge
+        vector3 n0 = vector3(0.0, z0, -y0).unit();
+        vector3 n1 = vector3(-z0, 0.0, x1).unit();
+        vector3 n2 = vector3(0.0, -z0, y1).unit();
+        vector3 n3 = vector3(z0, 0.0, -x0).unit();
+
+        double g0 = std::acos(std::clamp(-n0.dot(n1), -1.0, 1.0));
+        double g1 = std::acos(std::clamp(-n1.dot(n2), -1.0, 1.0));
+        double g2 = std::acos(std::clamp(-n2.dot(n3), -1.0, 1.0));
+        double g3 = std::acos(std::clamp(-n3.dot(n0), -1.0, 1.0));
+
+        b0 = n0.z;
+        b1 = n2.z;
+        k = 2.0 * M_PI - g2 - g3;
+        solid_angle = g0 + g1 - k;
+        return solid_angle > 1e-12;
+    }
 
-            for (int i = 0; i < num_samples; ++i) {
-                vector3 sample_point = light.sample_point_on_surface(); // random sample
-                vector3 light_dir = (sample_point - point).unit();
+    vector3 sample(double s, double t) const {
+        double au = s * solid_angle + k;
+        double fu = (std::cos(au) * b0 - b1) / std::sin(au);
+        double cu = std::clamp((fu > 0.0 ? 1.0 : -1.0) / std::sqrt(fu * fu + b0 * b0), -1.0, 1.0);
+        double xu = std::clamp(-(cu * z0) / std::sqrt(std::max(0.0, 1.0 - cu * cu)), x0, x1);
 
-                // Shadow factor
-                double shadow_factor = compute_shadow_factor(point, sample_point);
+        double d = std::sqrt(xu * xu + z0 * z0);
+        double h0 = y0 / std::sqrt(d * d + y0 * y0);
+        double h1 = y1 / std::sqrt(d * d + y1 * y1);
+        double hv = h0 + t * (h1 - h0);
+        double yv = hv * hv < 1.0 - 1e-9 ? (hv * d) / std::sqrt(1.0 - hv * hv) : y1;
 
-                // Diffuse component
-                double diff = std::max(0.0, normal.dot(light_dir));
-                vector3 diffuse = material.kd * diff * texture_color * light.intensity / num_samples;
+        return origin + xu * x + yv * y + z0 * z;
+    }
+};
 
-                // Specular component
-                vector3 half_vector = (view_dir + light_dir).unit();
-                double spec = std::pow(std::max(0.0, normal.dot(half_vector)), material.specularexponent);
-                vector3 specular = material.ks * spec * material.specularcolor * light.intensity / num_samples;
+void Scene::sample_light(
+    const Light& light,
+    const vector3& point,
+    const vector3& normal,
+    const vector3& view_dir,
+    const Material& material,
+    const vector3& texture_color,
+    std::vector<LightSample>& samples
+) const {
+    if (light.type == LightType::Point) {
+        samples.push_back({light.position, light_contribution(light, light.position, point, normal, view_dir, material, texture_color, 1.0), &light});
+
+    } else if (light.type == LightType::Area) {
+        const int n = light.samples;
+
+        // The shading model averages over the light's area, so a point drawn with solid-angle
+        // density 1/solid_angle is weighted by (dA/dw) / (area * pdf) = dist^2 * solid_angle / (cos * area)
+        SphericalRectangle rect;
+        bool solid_angle = light_sampling == LightSampling::SolidAngle && rect.init(light, point);
+        vector3 light_normal = light.u.cross(light.v);
+        double area = light.width * light.height;
+
+        for (int i = 0; i < n; ++i) {
+            if (light_sampling == LightSampling::Uniform) {
+                auto [s, t] = sample_2d();
+                vector3 sample_point = light.point_at(s, t); // random sample
+                samples.push_back({sample_point, light_contribution(light, sample_point, point, normal, view_dir, material, texture_color, 1.0 / n), &light});
+                continue;
+            }
 
-                area_color += shadow_factor * (diffuse + specular);
+            auto [s, t] = jittered_sample(i, n);
+            if (!solid_angle) {
+                vector3 sample_point = light.point_at(s, t);
+                samples.push_back({sample_point, light_contribution(light, sample_point, point, normal, view_dir, material, texture_color, 1.0 / n), &light});
+                continue;
             }
-            color += area_color;
+
+            vector3 sample_point = rect.sample(s, t);
+            vector3 to_light = sample_point - point;
+            double dist2 = to_light.dot(to_light);
+            double cos_light = std::abs(light_normal.dot(to_light)) / std::sqrt(dist2);
+            if (cos_light < 1e-9) continue;
+            double weight = dist2 * rect.solid_angle / (cos_light * area * n);
+            samples.push_back({sample_point, light_contribution(light, sample_point, point, normal, view_dir, material, texture_color, weight), &light});
         }
-        
     }
+}
+
+vector3 Scene::light_contribution(
+    const Light& light,
+    const vector3& light_position,
+    const vector3& point,
+    const vector3& normal,
+    const vector3& view_dir,
+    const Material& material,
+    const vector3& texture_color,
+    double weight
+) const {
+    vector3 light_dir = (light_position - point).unit();
+    vector3 half_vector = (view_dir + light_dir).unit();
+
+    // Diffuse component
+    double diff = std::max(0.0, normal.dot(light_dir));
+    vector3 diffuse = material.kd * diff * texture_color * light.intensity * weight;
+
+    // Specular component
+    double spec = std::pow(std::max(0.0, normal.dot(half_vector)), material.specularexponent);
+    vector3 specular = material.ks * spec * material.specularcolor * light.intensity * weight;
+
+    return diffuse + specular;
+}
+
+vector3 Scene::shade_area_light_adaptive(
+    const Light& light,
+    const vector3& point,
+    const vector3& normal,
+    const vector3& view_dir,
+    const Material& material,
+    const vector3& texture_color
+) const {
+    static const double probes[5][2] = { {0.0, 0.0}, {1.0, 0.0}, {0.0, 1.0}, {1.0, 1.0}, {0.5, 0.5} };
+    const int num_probes = 5;
+
+    // Fully lit or fully occluded points are settled by the probes alone
+    vector3 color(0.0, 0.0, 0.0);
+    double first_shadow = -1.0;
+    bool agree = true;
+    for (const auto& probe : probes) {
+        vector3 sample_point = light.point_at(probe[0], probe[1]);
+        double shadow_factor = compute_shadow_factor(point, sample_point, &light);
+        if (first_shadow < 0.0) first_shadow = shadow_factor;
+        agree = agree && shadow_factor == first_shadow;
+        color += shadow_factor * light_contribution(light, sample_point, point, normal, view_dir, material, texture_color, 1.0 / num_probes);
+    }
+    if (agree) return color;
+
+    // Penumbra: spend the light's full budget
+    thread_state().shadow.penumbra_escalations++;
+    static thread_local std::vector<LightSample> samples;
+    samples.clear();
+    sample_light(light, point, normal, view_dir, material, texture_color, samples);
 
+    color = vector3(0.0, 0.0, 0.0);
+    for (const auto& sample : samples) {
+        color += compute_shadow_factor(point, sample.position, &light) * sample.contribution;
+    }
     return color;
 }
 
 // Checks if a point is in shadow by casting a shadow ray to the light source
-double Scene::compute_shadow_factor(const vector3& point, const vector3& light_position) const {
+double Scene::compute_shadow_factor(const vector3& point, const vector3& light_position, const Light* light) const {
+    ShadingThreadState& state = thread_state();
+    state.shadow.shadow_rays++;
     vector3 light_dir = (light_position - point).unit();
     ray shadow_ray(point + light_dir * 0.001, light_dir); // Offset to avoid self-intersection
+    double max_t = (light_position - point).length();
+
+    // Neighbouring shading points are usually blocked from a light by the same primitive, so each
+    // thread keeps the last occluder per light and tries it first, with the same test as the traversal
+    const Shape** cached = nullptr;
+    if (use_occluder_cache && light) {
+        std::vector<const Shape*>& last_occluder = state.last_occluder;
+        if (last_occluder.size() != lights.size()) last_occluder.assign(lights.size(), nullptr);
+        cached = &last_occluder[light - lights.data()];
+
+        if (*cached) {
+            state.shadow.occluder_cache_lookups++;
+            double t = 0;
+            if ((*cached)->intersects(shadow_ray, t) && t < max_t && t > 1e-4) {
+                state.shadow.occluder_cache_hits++;
+                return 0.1; // In shadow
+            }
+        }
+    }
 
     double t_shadow;
     std::shared_ptr<Shape> shadow_hit_shape;
-    if (intersects(shadow_ray, t_shadow, shadow_hit_shape, (light_position - point).length())) {
+    if (intersects(shadow_ray, t_shadow, shadow_hit_shape, max_t)) {
+        if (cached) *cached = shadow_hit_shape.get();
         return 0.1; // In shadow
     }
     return 1.0; // Fully lit
@@ -260,10 +781,7 @@ vector3 Scene::compute_reflection(
 ) const {
     if (nbounces <= 0 || !material.isreflective) return vector3(0.0, 0.0, 0.0);
 
-    vector3 reflect_dir = r.direction - 2 * (normal.dot(r.direction)) * normal;
-    ray reflect_ray(hit_point + reflect_dir * 0.001, reflect_dir);
-
-    return shade_blinn_phong(reflect_ray, nbounces - 1) * material.reflectivity;
+    return shade_blinn_phong(reflect_ray(r, hit_point, normal), nbounces - 1) * material.reflectivity;
 }
 
 // Computes the refraction colour by recursively shading the refracted ray
@@ -276,6 +794,26 @@ vector3 Scene::compute_refraction(
 ) const {
     if (nbounces <= 0) return vector3(0.0, 0.0, 0.0);
 
+    ray refracted_ray(hit_point, normal);
+    if (!refract_ray(r, hit_point, normal, material, refracted_ray)) {
+        return vector3(0.0, 0.0, 0.0); // TIR
+    }
+
+    // Calculate the refraction color by recursively shading the refracted ray
+    vector3 refraction_color = shade_blinn_phong(refracted_ray, nbounces - 1);
+
+    // Attenuate the refraction color by the material's transparency
+    return refraction_color * material.transparency;
+}
+
+// Mirrors the ray about the normal, starting just off the surface
+ray Scene::reflect_ray(const ray& r, const vector3& hit_point, const vector3& normal) const {
+    vector3 reflect_dir = r.direction - 2 * (normal.dot(r.direction)) * normal;
+    return ray(hit_point + reflect_dir * 0.001, reflect_dir);
+}
+
+// Bends the ray through the surface with Snell's law; returns false on total internal reflection
+bool Scene::refract_ray(const ray& r, const vector3& hit_point, const vector3& normal, const Material& material, ray& refracted) const {
     // Adjust normal if necessary
     vector3 adjusted_normal = normal.dot(r.direction) < 0 ? normal : -normal;
 
@@ -302,7 +840,7 @@ vector3 Scene::compute_refraction(
 
     // Check for total internal reflection (TIR)
     if (sin2_theta_t > 1.0 + 1e-6) {
-        return vector3(0.0, 0.0, 0.0); // TIR
+        return false;
     }
 
     // Calculate the cosine of the refracted angle
@@ -313,13 +851,8 @@ vector3 Scene::compute_refraction(
     refract_dir = refract_dir.unit();
 
     // Generate the refracted ray
-    ray refracted_ray(hit_point + refract_dir * 0.1, refract_dir);
-
-    // Calculate the refraction color by recursively shading the refracted ray
-    vector3 refraction_color = shade_blinn_phong(refracted_ray, nbounces - 1);
-
-    // Attenuate the refraction color by the material's transparency
-    return refraction_color * material.transparency;
+    refracted = ray(hit_point + refract_dir * 0.1, refract_dir);
+    return true;
 }
 
 // Randomly sample a point on the surface of the area light
@@ -329,5 +862,5 @@ vector3 Light::sample_point_on_surface() const {
     }
     double rand_u = random_double(0.0, 1.0);
     double rand_v = random_double(0.0, 1.0);
-    return position + (rand_u * width * u) + (rand_v * height * v);
+    return point_at(rand_u, rand_v);
 }
@@ -4,31 +4,83 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include "vector3.h"
 #include "ray.h"
 #include "shape.h"
 #include "sphere.h"
 #include "triangle.h"
 #include "cylinder.h"
+#include "light.h"
+#include "light_bvh.h"
 #include "json.hpp"
 
-enum class LightType {
-    Point,
-    Area
+// A light chosen to be shaded at a point, with the weight that keeps the sum over lights unbiased
+struct LightPick {
+    const Light* light;
+    double weight;
 };
 
-struct Light {
-    LightType type; // point or area
-    vector3 position; // centre of light source
-    vector3 intensity;
-    vector3 u; // u-axis for area light
-    vector3 v; // v-axis for area light
-    double width;
-    double height;
-    
-    vector3 sample_point_on_surface() const;
+// One shadow-ray target together with the light it delivers when unoccluded
+struct LightSample {
+    vector3 position;
+    vector3 contribution; // diffuse + specular
+    const Light* light = nullptr;
 };
 
+// A ray still to be shaded by the iterative integrator, with the weight its colour gets in the pixel
+struct RayTask {
+    ray r;
+    vector3 throughput;
+    int depth; // remaining nbounces
+};
+
+// Secondary rays spawned by the iterative/wavefront integrators and how many were never traced.
+// Counted per thread, see Scene::shading_stats()
+struct ShadingStats {
+    long rays_spawned = 0;
+    long rays_pruned = 0;      // throughput below Scene::min_throughput
+    long rays_terminated = 0;  // lost at Russian roulette
+
+    void merge(const ShadingStats& other) {
+        rays_spawned += other.rays_spawned;
+        rays_pruned += other.rays_pruned;
+        rays_terminated += other.rays_terminated;
+    }
+};
+
+// The shadow rays cast by any integrator. Counted per thread, see Scene::shadow_stats()
+struct ShadowStats {
+    long shadow_rays = 0;
+    long penumbra_escalations = 0;   // adaptive area-light probes that disagreed
+    long occluder_cache_lookups = 0;
+    long occluder_cache_hits = 0;    // shadow rays settled by the cached occluder alone
+
+    void merge(const ShadowStats& other) {
+        shadow_rays += other.shadow_rays;
+        penumbra_escalations += other.penumbra_escalations;
+        occluder_cache_lookups += other.occluder_cache_lookups;
+        occluder_cache_hits += other.occluder_cache_hits;
+    }
+};
+
+// What one thread keeps between the rays it shades in a scene. The scene owns it, so it never outlives
+// the shapes it points to. Cache-line aligned so threads bumping their counters don't share a line
+struct alignas(64) ShadingThreadState {
+    std::thread::id owner;
+    std::vector<const Shape*> last_occluder; // per light, see Scene::use_occluder_cache
+    ShadingStats shading;
+    ShadowStats shadow;
+};
+
+// How shadow-ray targets are spread over area lights
+enum class LightSampling {
+    Uniform,     // independent uniform points on the rectangle
+    Stratified,  // one jittered point per cell of a grid over the rectangle
+    SolidAngle   // jittered grid mapped onto the rectangle's spherical projection
+};
 
 enum class RenderMode {
         Binary,
@@ -44,6 +96,40 @@ public:
     std::shared_ptr<BVH> bvh;
     bool use_bvh = false;
     bool enable_antialiasing = false;
+    bool use_iterative = false; // shade with an explicit ray stack instead of recursion
+
+    // Ray-tree pruning for the iterative and wavefront integrators: secondary rays whose largest throughput component
+    // is below min_throughput are dropped, and with russian_roulette on, those below roulette_threshold
+    // survive with probability throughput / roulette_threshold and are reweighted to stay unbiased
+    double min_throughput = 0.0;
+    bool russian_roulette = false;
+    double roulette_threshold = 0.1;
+
+    // Each thread remembers the last occluder of every light and tests it before traversing the scene.
+    // Off by default: on scenes where the last occluder rarely blocks the next ray (bvh_stress_test) the
+    // extra test costs more than the traversals it saves
+    bool use_occluder_cache = false;
+
+    // The calling thread's ShadingThreadState for this scene, created on its first call
+    ShadingThreadState& thread_state() const;
+
+    // The counters of every thread added up; read them between renders
+    ShadingStats shading_stats() const;
+    ShadowStats shadow_stats() const;
+
+    // Area lights are first probed at their corners and centre; the full sample budget is only
+    // spent where the probes disagree about visibility
+    bool adaptive_shadows = false;
+    LightSampling light_sampling = LightSampling::Uniform;
+
+    // Many-light sampling: with a light BVH, `light_picks` lights are drawn per shading point instead of
+    // looping over all of them. Lights whose estimated contribution is below `light_cutoff` are skipped
+    std::shared_ptr<LightBVH> light_bvh;
+    int light_picks = 4;
+    double light_cutoff = 0.0;
+
+    // At hits that both reflect and refract, follow only one branch, picked by Schlick's Fresnel term
+    bool stochastic_fresnel = false;
 
     /* --------------- Scene parsing --------------- */
 
@@ -75,15 +161,23 @@ public:
         }
     }
 
-    bool intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t) const {
+    void build_light_bvh() {
+        light_bvh = std::make_shared<LightBVH>(lights);
+    }
+
+    bool intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t, NodeCache* cache = nullptr) const {
         if (use_bvh) {
-            return bvh->intersects(r, t_hit, hit_shape, max_t);
+            return bvh->intersects(r, t_hit, hit_shape, max_t, cache);
         }
         return brute_force_intersects(r, t_hit, hit_shape, max_t);
     }
 
     bool brute_force_intersects(const ray& r, double& t_hit, std::shared_ptr<Shape>& hit_shape, double max_t) const;
 
+    // Packet of coherent rays: finds the closest hit of every active lane together
+    template <int N>
+    maskxN<N> intersects(const ray_packet<N>& r, const maskxN<N>& active, doublexN<N>& t_hit, const Shape* hit_shapes[], double max_t, PacketStats& stats) const;
+
 
     /* --------------- Shading / reflection / refraction --------------- */
 
@@ -92,6 +186,19 @@ public:
         int nbounces
     ) const;
 
+    // Primary-ray packet: hits are found for the whole packet, shading then continues ray by ray
+    template <int N>
+    void shade(
+        const ray_packet<N>& r,
+        const maskxN<N>& active,
+        int nbounces,
+        vector3 colors[],
+        PacketStats& stats
+    ) const;
+
+    // Depth of the first hit for the active AOVSample, if any
+    void record_aov_depth(const ray& r, double t_hit) const;
+
     vector3 compute_blinn_phong(
         const vector3& point,
         const vector3& normal,
@@ -100,8 +207,53 @@ public:
         const Shape& shape
     ) const;
 
-    double compute_shadow_factor(const vector3& point, const vector3& light_position) const;
-    // double compute_shadow_factor(const vector3& point, const Light& light) const;
+    void sample_lights(
+        const vector3& point,
+        const vector3& normal,
+        const vector3& view_dir,
+        const Material& material,
+        const Shape& shape,
+        std::vector<LightSample>& samples
+    ) const;
+
+    // Lights to shade at a point: all of them, or a weighted few drawn from the light BVH
+    void select_lights(const vector3& point, const vector3& normal, std::vector<LightPick>& picks) const;
+
+    // Shadow-ray targets of a single light; `texture_color` is the surface colour at `point`
+    void sample_light(
+        const Light& light,
+        const vector3& point,
+        const vector3& normal,
+        const vector3& view_dir,
+        const Material& material,
+        const vector3& texture_color,
+        std::vector<LightSample>& samples
+    ) const;
+
+    // Unshadowed diffuse + specular from one point on a light, scaled by `weight`
+    vector3 light_contribution(
+        const Light& light,
+        const vector3& light_position,
+        const vector3& point,
+        const vector3& normal,
+        const vector3& view_dir,
+        const Material& material,
+        const vector3& texture_color,
+        double weight
+    ) const;
+
+    // Shadowed light from an area light with corner/centre probes, escalating to the full budget in penumbrae
+    vector3 shade_area_light_adaptive(
+        const Light& light,
+        const vector3& point,
+        const vector3& normal,
+        const vector3& view_dir,
+        const Material& material,
+        const vector3& texture_color
+    ) const;
+
+    // `light`, when given, lets the shadow ray try the last primitive that blocked that light first
+    double compute_shadow_factor(const vector3& point, const vector3& light_position, const Light* light = nullptr) const;
 
     vector3 compute_reflection(
         const ray& r,
@@ -126,6 +278,37 @@ public:
 
     vector3 shade_blinn_phong(const ray& r, int nbounces) const;
 
+    // Same result as shade_surface / shade_blinn_phong, but walks the reflection/refraction tree
+    // with an explicit stack of RayTasks instead of recursing
+    vector3 shade_surface_iterative(
+        const ray& r,
+        const vector3& hit_point,
+        const vector3& normal,
+        const Shape& shape,
+        int nbounces
+    ) const;
+
+    vector3 shade_iterative(const ray& r, int nbounces) const;
+
+    // Schlick's approximation of the Fresnel reflectance for a ray hitting a dielectric
+    double fresnel_schlick(const ray& r, const vector3& normal, const Material& material) const;
+
+    // Stochastic Fresnel split: true to follow the reflection, false for the refraction.
+    // `weight` is one over the probability of the chosen branch
+    bool choose_reflection(const ray& r, const vector3& normal, const Material& material, double& weight) const;
+
+    // Decides whether a secondary ray is traced; may scale its throughput after Russian roulette
+    bool keep_ray(vector3& throughput) const;
+
+    // Local colour of one hit weighted by its throughput; pushes the reflection/refraction rays it spawns
+    vector3 shade_task(
+        const RayTask& task,
+        const vector3& hit_point,
+        const vector3& normal,
+        const Shape& shape,
+        std::vector<RayTask>& stack
+    ) const;
+
     vector3 compute_refraction(
         const ray& r_in,              // Incoming ray
         const vector3& hit_point,     // Point of intersection
@@ -134,6 +317,10 @@ public:
         int nbounces                     // Recursion depth
     ) const;
 
+    ray reflect_ray(const ray& r, const vector3& hit_point, const vector3& normal) const;
+
+    bool refract_ray(const ray& r, const vector3& hit_point, const vector3& normal, const Material& material, ray& refracted) const;
+
     // KEPT IN NEW CPP
     vector3 compute_refracted_direction(
         const vector3& incident,
@@ -142,6 +329,13 @@ public:
         double ior_out
     ) const;
 
+private:
+    // Tells scenes apart in the per-thread lookup of thread_state(); unlike the address it is never reused
+    const long id = next_id++;
+    static std::atomic<long> next_id;
+
+    mutable std::mutex thread_states_mutex;
+    mutable std::vector<std::unique_ptr<ShadingThreadState>> thread_states;
 };
 
 #endif
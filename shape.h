@@ -27,6 +27,12 @@ struct Material {
 };
 
 
+enum class ShapeType {
+    Sphere,
+    Triangle,
+    Cylinder
+};
+
 // Abstract Shape class
 class Shape {
 public:
@@ -47,6 +53,9 @@ public:
 
     // Get the bounding box of the shape
     virtual AABB get_bbox() const = 0;
+
+    // Concrete type, used to pick packet kernels without a virtual call per lane
+    virtual ShapeType get_type() const = 0;
     
 };
 
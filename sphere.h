@@ -36,6 +36,14 @@ public:
         return true;
     }
 
+    // Packet ray-sphere intersection, same rules as the scalar test lane by lane (kernel in simd_kernels.inc)
+    template <int N>
+    maskxN<N> intersects(const ray_packet<N>& r, doublexN<N>& t_hit, const maskxN<N>& active) const {
+        maskxN<N> hit;
+        packet_kernels<N>().sphere(*this, r, t_hit, active, hit);
+        return hit;
+    }
+
     vector3 get_normal(const vector3& point) const {
         return (point - center).unit();
     }
@@ -47,6 +55,8 @@ public:
         return {u, v};
     }
 
+    ShapeType get_type() const override { return ShapeType::Sphere; }
+
     AABB get_bbox() const override {
         AABB bbox;
         bbox.min = center - vector3(radius, radius, radius);
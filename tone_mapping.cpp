@@ -1,5 +1,12 @@
 #include "tone_mapping.h"
+#include "lut_interpolation.h"
+#include "cpu_dispatch.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 
 // Scales the pixel values based on the average scene luminance
 vector3 reinhard_tone_mapping(const vector3& color) {
@@ -20,3 +27,221 @@ vector3 aces_tone_mapping(const vector3& color) {
     const float e = 0.14f;
     return (color * (a * color + b)) / (color * (c * color + d) + e);
 }
+
+// Raises each component to 1 / gamma
+vector3 gamma_correction(const vector3& color, float gamma) {
+    double inverse = 1.0 / gamma;
+    return vector3(std::pow(color.x, inverse), std::pow(color.y, inverse), std::pow(color.z, inverse));
+}
+
+bool parse_tone_map_operator(const std::string& name, ToneMapOperator& op) {
+    if (name == "none") op = ToneMapOperator::None;
+    else if (name == "exposure") op = ToneMapOperator::Exposure;
+    else if (name == "reinhard") op = ToneMapOperator::Reinhard;
+    else if (name == "aces") op = ToneMapOperator::ACES;
+    else return false;
+    return true;
+}
+
+bool load_cube_lut(const std::string& filename, ColorLUT& lut, std::string& error) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        error = "cannot open " + filename;
+        return false;
+    }
+
+    lut = ColorLUT();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        std::string keyword;
+        if (!(in >> keyword)) continue;
+
+        if (keyword == "TITLE") {
+            continue;
+        } else if (keyword == "LUT_3D_SIZE") {
+            in >> lut.size;
+            if (!in || lut.size < 2 || lut.size > 256) {
+                error = "bad LUT_3D_SIZE on line " + std::to_string(line_number);
+                return false;
+            }
+            lut.table.reserve(3 * static_cast<size_t>(lut.size) * lut.size * lut.size);
+        } else if (keyword == "DOMAIN_MIN" || keyword == "DOMAIN_MAX") {
+            vector3& bound = keyword == "DOMAIN_MIN" ? lut.domain_min : lut.domain_max;
+            in >> bound.x >> bound.y >> bound.z;
+            if (!in) {
+                error = "bad " + keyword + " on line " + std::to_string(line_number);
+                return false;
+            }
+        } else if (keyword == "LUT_1D_SIZE" || keyword == "LUT_1D_INPUT_RANGE" || keyword == "LUT_3D_INPUT_RANGE") {
+            error = keyword + " is not supported, only plain 3D LUTs";
+            return false;
+        } else {
+            std::istringstream values(line);
+            double r, g, b;
+            if (!(values >> r >> g >> b) || lut.size == 0) {
+                error = "unexpected data on line " + std::to_string(line_number);
+                return false;
+            }
+            lut.table.push_back(static_cast<float>(r));
+            lut.table.push_back(static_cast<float>(g));
+            lut.table.push_back(static_cast<float>(b));
+        }
+    }
+
+    size_t expected = 3 * static_cast<size_t>(lut.size) * lut.size * lut.size;
+    if (lut.size == 0 || lut.table.size() != expected) {
+        error = "expected " + std::to_string(expected / 3) + " LUT entries, found " + std::to_string(lut.table.size() / 3);
+        return false;
+    }
+    if (!(lut.domain_max.x > lut.domain_min.x && lut.domain_max.y > lut.domain_min.y && lut.domain_max.z > lut.domain_min.z)) {
+        error = "empty LUT domain";
+        return false;
+    }
+    return true;
+}
+
+// (size - 1) / (domain_max - domain_min) per axis
+static inline vector3 lut_scale(const ColorLUT& lut) {
+    return vector3(lut.size - 1, lut.size - 1, lut.size - 1) / (lut.domain_max - lut.domain_min);
+}
+
+vector3 ColorLUT::apply(const vector3& color) const {
+    const vector3 scale = lut_scale(*this);
+    double fr, fg, fb;
+    int base = lut_cell(color.x, domain_min.x, scale.x, size, fr)
+             + lut_cell(color.y, domain_min.y, scale.y, size, fg) * size
+             + lut_cell(color.z, domain_min.z, scale.z, size, fb) * size * size;
+    LUTTetrahedron t = lut_tetrahedron(fr, fg, fb, size);
+    const float* c0 = &table[3 * base];
+    const float* c1 = c0 + 3 * t.step1;
+    const float* c2 = c0 + 3 * t.step2;
+    const float* c3 = c0 + 3 * (1 + size + size * size);
+    double out[3];
+    for (int k = 0; k < 3; ++k) out[k] = t.w0 * c0[k] + t.w1 * c1[k] + t.w2 * c2[k] + t.w3 * c3[k];
+    return vector3(out[0], out[1], out[2]);
+}
+
+static double clamp_unit(double value) {
+    return value > 0.0 ? (value < 1.0 ? value : 1.0) : 0.0; // NaN goes to 0
+}
+
+vector3 tone_map(const vector3& color, const ToneMapSettings& settings) {
+    vector3 mapped = settings.scale == 1.0 ? color : color * settings.scale;
+    const vector3 scaled = mapped;
+    switch (settings.op) {
+        case ToneMapOperator::None: break;
+        case ToneMapOperator::Exposure: mapped = exposure_tone_mapping(scaled, settings.exposure); break;
+        case ToneMapOperator::Reinhard: mapped = reinhard_tone_mapping(scaled); break;
+        case ToneMapOperator::ACES: mapped = aces_tone_mapping(scaled); break;
+        case ToneMapOperator::LUT: mapped = settings.lut->apply(scaled); break;
+    }
+    mapped = vector3(clamp_unit(mapped.x), clamp_unit(mapped.y), clamp_unit(mapped.z));
+    return settings.gamma == 1.0f ? mapped : gamma_correction(mapped, settings.gamma);
+}
+
+ToneMapBlock::ToneMapBlock(const ToneMapSettings& settings)
+    : op(settings.op), scale(settings.scale), exposure(settings.exposure), gamma(settings.gamma) {
+    if (op == ToneMapOperator::LUT) {
+        const vector3 lut_step = ::lut_scale(*settings.lut);
+        lut_table = settings.lut->table.data();
+        lut_size = settings.lut->size;
+        lut_min[0] = settings.lut->domain_min.x;
+        lut_min[1] = settings.lut->domain_min.y;
+        lut_min[2] = settings.lut->domain_min.z;
+        lut_scale[0] = lut_step.x;
+        lut_scale[1] = lut_step.y;
+        lut_scale[2] = lut_step.z;
+    }
+}
+
+void tone_map_to_rgb8(const vector3* pixels, size_t count, const ToneMapSettings& settings, unsigned char* rgb) {
+    const ToneMapBlock block_settings(settings);
+    const auto tone_map_block = simd_kernels().tone_map_block;
+    const long blocks = static_cast<long>((count + ToneMapBlock::pixels - 1) / ToneMapBlock::pixels);
+
+    #pragma omp parallel for
+    for (long block = 0; block < blocks; ++block) {
+        size_t first = static_cast<size_t>(block) * ToneMapBlock::pixels;
+        int n = static_cast<int>(std::min<size_t>(ToneMapBlock::pixels, count - first));
+        tone_map_block(pixels + first, n, block_settings, rgb + 3 * first);
+    }
+}
+
+void LuminanceHistogram::add(const vector3& color) {
+    double luminance = 0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z;
+    if (!(luminance >= std::ldexp(1.0, min_log2))) return; // also skips NaN
+    uint64_t bits;
+    std::memcpy(&bits, &luminance, sizeof(bits));
+    int octave = static_cast<int>(bits >> 52) - 1023 - min_log2;
+    int step = static_cast<int>(bits >> (52 - 3)) & (octave_bins - 1);
+    counts[std::min(octave * octave_bins + step, bins - 1)]++;
+    total++;
+}
+
+void LuminanceHistogram::merge(const LuminanceHistogram& other) {
+    for (int i = 0; i < bins; ++i) counts[i] += other.counts[i];
+    total += other.total;
+}
+
+double LuminanceHistogram::bin_log2(int i) {
+    return min_log2 + i / octave_bins + std::log2(1.0 + (i % octave_bins + 0.5) / octave_bins);
+}
+
+LuminanceHistogram luminance_histogram(const vector3* pixels, int width, int height, int stride) {
+    LuminanceHistogram histogram;
+    stride = std::max(1, stride);
+
+    #pragma omp parallel
+    {
+        LuminanceHistogram local;
+        #pragma omp for nowait
+        for (int y = 0; y < height; y += stride) {
+            const vector3* row = pixels + static_cast<size_t>(y) * width;
+            for (int x = 0; x < width; x += stride) {
+                local.add(row[x]);
+            }
+        }
+        #pragma omp critical
+        histogram.merge(local);
+    }
+    return histogram;
+}
+
+double average_luminance(const LuminanceHistogram& histogram, const AutoExposureSettings& settings) {
+    if (histogram.total == 0) return 0.0;
+
+    // Only the part of each bin between the two percentile ranks counts, at the bin's centre
+    const double low = histogram.total * std::clamp(settings.low_percentile, 0.0, 100.0) / 100.0;
+    const double high = std::max(low, histogram.total * std::clamp(settings.high_percentile, 0.0, 100.0) / 100.0);
+    double below = 0.0, weight = 0.0, log_sum = 0.0;
+    for (int i = 0; i < LuminanceHistogram::bins; ++i) {
+        double count = static_cast<double>(histogram.counts[i]);
+        double inside = std::min(below + count, high) - std::max(below, low);
+        if (inside > 0.0) {
+            weight += inside;
+            log_sum += inside * LuminanceHistogram::bin_log2(i);
+        }
+        below += count;
+    }
+    if (weight == 0.0) { // both percentiles in the same spot: use that bin
+        long seen = 0;
+        for (int i = 0; i < LuminanceHistogram::bins; ++i) {
+            seen += histogram.counts[i];
+            if (seen >= low) return std::exp2(LuminanceHistogram::bin_log2(i));
+        }
+    }
+    return std::exp2(log_sum / weight);
+}
+
+double apply_auto_exposure(const vector3* pixels, int width, int height, const AutoExposureSettings& settings, ToneMapSettings& tone_mapping) {
+    double average = average_luminance(luminance_histogram(pixels, width, height, settings.stride), settings);
+    if (average > 0.0) {
+        tone_mapping.scale = settings.key / average;
+        tone_mapping.exposure = 1.0f;
+    }
+    return average;
+}
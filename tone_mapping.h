@@ -1,6 +1,11 @@
 #ifndef TONE_MAPPING_H
 #define TONE_MAPPING_H
 
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
 #include "vector3.h"
 
 vector3 reinhard_tone_mapping(const vector3& color);
@@ -8,4 +13,104 @@ vector3 exposure_tone_mapping(const vector3& color, float exposure);
 vector3 aces_tone_mapping(const vector3& color);
 vector3 gamma_correction(const vector3& color, float gamma);
 
+enum class ToneMapOperator {
+    None,      // linear, only clamped
+    Exposure,  // 1 - exp(-exposure * c)
+    Reinhard,  // c / (c + 1)
+    ACES,      // Narkowicz's fit of the ACES filmic curve
+    LUT        // a baked 3D LUT (tone curve and grade in one), see ColorLUT
+};
+
+// Parses "none", "exposure", "reinhard" or "aces"; returns false for anything else
+bool parse_tone_map_operator(const std::string& name, ToneMapOperator& op);
+
+// A 3D colour LUT as found in .cube files: size^3 RGB entries, red varying fastest, sampling the input
+// cube [domain_min, domain_max] at evenly spaced points. Inputs outside the domain are clamped to it
+struct ColorLUT {
+    int size = 0;
+    std::vector<float> table;  // 3 * size^3 values
+    vector3 domain_min = vector3(0, 0, 0);
+    vector3 domain_max = vector3(1, 1, 1);
+
+    // Tetrahedral interpolation: the cell around the input is split into six tetrahedra along its main
+    // diagonal and only the four corners of the one containing the input are blended
+    vector3 apply(const vector3& color) const;
+};
+
+// Reads an Adobe/Resolve .cube file with a LUT_3D_SIZE table (1D LUTs and shapers are not supported)
+bool load_cube_lut(const std::string& filename, ColorLUT& lut, std::string& error);
+
+// Everything between the linear framebuffer and 8-bit output. The defaults leave values untouched
+struct ToneMapSettings {
+    ToneMapOperator op = ToneMapOperator::None;
+    double scale = 1.0;     // linear factor applied before the operator, set by auto exposure
+    float exposure = 1.0f;  // only used by ToneMapOperator::Exposure
+    float gamma = 1.0f;     // 1 = no gamma correction, which is how output has always been written
+    std::shared_ptr<const ColorLUT> lut;  // only used by ToneMapOperator::LUT
+};
+
+// One pixel through the operator and gamma, clamped to [0, 1]; the reference for tone_map_to_rgb8
+vector3 tone_map(const vector3& color, const ToneMapSettings& settings);
+
+// The post-process stage: tone maps, gamma corrects and quantizes `count` pixels to 8-bit RGB. Pixels are
+// processed in blocks transposed to structure-of-arrays so every step is a plain loop over lanes, and the
+// blocks are spread over threads
+void tone_map_to_rgb8(const vector3* pixels, size_t count, const ToneMapSettings& settings, unsigned char* rgb);
+
+// ToneMapSettings resolved to plain values for the block kernel, which is compiled once per instruction
+// set (see cpu_dispatch.h) and so can't call into shared_ptr or vector
+struct ToneMapBlock {
+    static constexpr int pixels = 64;  // 3 x 64 doubles stay in L1 and every lane loop has a fixed trip count
+
+    ToneMapOperator op = ToneMapOperator::None;
+    double scale = 1.0;
+    double exposure = 1.0;
+    float gamma = 1.0f;
+    const float* lut_table = nullptr;  // ToneMapOperator::LUT only
+    int lut_size = 0;
+    double lut_min[3] = {};
+    double lut_scale[3] = {};
+
+    explicit ToneMapBlock(const ToneMapSettings& settings);
+};
+
+// Histogram of log2 luminance (Rec. 709 weights): each octave from 2^min_log2 to 2^max_log2 is split into
+// octave_bins linear steps, so the bin comes straight from the exponent and top mantissa bits of the
+// luminance. Darker pixels (the background, shadow acne) are left out, brighter ones land in the last bin
+struct LuminanceHistogram {
+    static constexpr int min_log2 = -20;
+    static constexpr int max_log2 = 12;
+    static constexpr int octave_bins = 8;
+    static constexpr int bins = (max_log2 - min_log2) * octave_bins;
+
+    std::array<long, bins> counts = {};
+    long total = 0;
+
+    void add(const vector3& color);
+    void merge(const LuminanceHistogram& other);
+
+    // log2 of the middle of bin i
+    static double bin_log2(int i);
+};
+
+// Histogram of every stride-th pixel of every stride-th row, built with one private copy per thread that
+// are merged at the end
+LuminanceHistogram luminance_histogram(const vector3* pixels, int width, int height, int stride);
+
+struct AutoExposureSettings {
+    bool enabled = false;
+    double key = 0.4;               // linear value the average luminance is scaled to
+    double low_percentile = 1.0;    // darkest share of the pixels (in percent) ignored for the average
+    double high_percentile = 99.0;  // pixels above this percentile are ignored too
+    int stride = 4;                 // histogram every stride-th pixel of every stride-th row
+};
+
+// Geometric mean of the luminance between the two percentiles; 0 if the histogram is empty
+double average_luminance(const LuminanceHistogram& histogram, const AutoExposureSettings& settings);
+
+// Sets tone_mapping.scale so the clipped average luminance of the frame maps to settings.key. The derived
+// value takes the place of a hand-tuned exposure, so the exposure operator's own factor is reset to 1.
+// Returns the average luminance it measured
+double apply_auto_exposure(const vector3* pixels, int width, int height, const AutoExposureSettings& settings, ToneMapSettings& tone_mapping);
+
 #endif
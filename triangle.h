@@ -57,6 +57,15 @@ public:
         return t_hit > 1e-8; // Ray intersects the triangle
     }
 
+    // Packet Möller–Trumbore: every lane runs the full test and the early-outs become masks
+    // (kernel in simd_kernels.inc)
+    template <int N>
+    maskxN<N> intersects(const ray_packet<N>& r, doublexN<N>& t_hit, const maskxN<N>& active) const {
+        maskxN<N> hit;
+        packet_kernels<N>().triangle(*this, r, t_hit, active, hit);
+        return hit;
+    }
+
     virtual std::pair<double, double> get_uv(const vector3& point) const override {
         double min_x = -1.0; // Surface bounds in the X direction
         double max_x = 1.0;
@@ -70,6 +79,8 @@ public:
         return {u, v};
     }
 
+    ShapeType get_type() const override { return ShapeType::Triangle; }
+
     // Get bounding box for the triangle
     AABB get_bbox() const override {
         AABB bbox;
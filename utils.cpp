@@ -1,15 +1,30 @@
 #include "utils.h"
 #include <random>
+#include <unistd.h>
+
+static std::mt19937& random_generator() {
+    // One generator per thread, so the parallel render loops never share (and race on) one state
+    static thread_local std::mt19937 gen(std::random_device{}());
+    return gen;
+}
 
 // Define the random_double function
 double random_double(double min, double max) {
-    static std::random_device rd;   // only one instance
-    static std::mt19937 gen(rd());
     std::uniform_real_distribution<> dis(min, max);
-    return dis(gen);
+    return dis(random_generator());
 }
 
 // Center normalised coordinates inside pixel
 std::pair<double, double> normalize_pixel(int i, int j, int width, int height) {
     return { (i + 0.5) / width, (j + 0.5) / height }; // Center pixel by default
-}
\ No newline at end of file
+}
+std::pair<double, double> jitter_pixel(int i, int j, double dx, double dy, int width, int height) {
+    return { (i + dx) / width, (j + dy) / height };
+}
+
+bool is_writable_path(const std::string& path) {
+    if (access(path.c_str(), F_OK) == 0) return access(path.c_str(), W_OK) == 0;
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+    return access(directory.c_str(), W_OK | X_OK) == 0;
+}
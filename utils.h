@@ -1,10 +1,19 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <random>
+#include <string>
 #include <utility>
 
 double random_double(double min, double max);
 
 std::pair<double, double> normalize_pixel(int i, int j, int width, int height);
 
+// Normalised coordinates of the point (dx, dy) in [0, 1)^2 inside pixel (i, j)
+std::pair<double, double> jitter_pixel(int i, int j, double dx, double dy, int width, int height);
+
+// True if `path` could be opened for writing: the file is writable, or it doesn't exist and its directory
+// is. Touches nothing on disk
+bool is_writable_path(const std::string& path);
+
 #endif
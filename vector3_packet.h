@@ -0,0 +1,138 @@
+#ifndef VECTOR3_PACKET_H
+#define VECTOR3_PACKET_H
+
+#include <cmath>
+#include <algorithm>
+#include "vector3.h"
+
+// SoA packet types: N lanes of scalars/vectors laid out so that each loop over the lanes
+// compiles to straight SIMD code (4 lanes = one AVX2 register of doubles, 8 lanes = AVX-512)
+
+// Lane masks hold all-ones/all-zero words, like SIMD compare results, so blends stay branch-free
+template <int N>
+struct maskxN {
+    alignas(32) long long m[N];
+
+    maskxN() { for (int i = 0; i < N; ++i) m[i] = 0; }
+    explicit maskxN(bool value) { for (int i = 0; i < N; ++i) m[i] = value ? -1 : 0; }
+
+    bool operator[](int i) const { return m[i] != 0; }
+    void set(int i, bool value) { m[i] = value ? -1 : 0; }
+
+    maskxN operator&(const maskxN& o) const { maskxN r; for (int i = 0; i < N; ++i) r.m[i] = m[i] & o.m[i]; return r; }
+    maskxN operator|(const maskxN& o) const { maskxN r; for (int i = 0; i < N; ++i) r.m[i] = m[i] | o.m[i]; return r; }
+    maskxN operator~() const { maskxN r; for (int i = 0; i < N; ++i) r.m[i] = ~m[i]; return r; }
+
+    // Horizontal reductions
+    bool any() const { long long r = 0; for (int i = 0; i < N; ++i) r |= m[i]; return r != 0; }
+    bool all() const { long long r = -1; for (int i = 0; i < N; ++i) r &= m[i]; return r != 0; }
+    bool none() const { return !any(); }
+    int count() const { int c = 0; for (int i = 0; i < N; ++i) c += m[i] != 0; return c; }
+};
+
+template <int N>
+struct doublexN {
+    alignas(32) double v[N];
+
+    doublexN() { for (int i = 0; i < N; ++i) v[i] = 0.0; }
+    doublexN(double s) { for (int i = 0; i < N; ++i) v[i] = s; } // broadcast
+
+    double operator[](int i) const { return v[i]; }
+    double& operator[](int i) { return v[i]; }
+
+    doublexN operator+(const doublexN& o) const { doublexN r; for (int i = 0; i < N; ++i) r.v[i] = v[i] + o.v[i]; return r; }
+    doublexN operator-(const doublexN& o) const { doublexN r; for (int i = 0; i < N; ++i) r.v[i] = v[i] - o.v[i]; return r; }
+    doublexN operator*(const doublexN& o) const { doublexN r; for (int i = 0; i < N; ++i) r.v[i] = v[i] * o.v[i]; return r; }
+    doublexN operator/(const doublexN& o) const { doublexN r; for (int i = 0; i < N; ++i) r.v[i] = v[i] / o.v[i]; return r; }
+    doublexN operator-() const { doublexN r; for (int i = 0; i < N; ++i) r.v[i] = -v[i]; return r; }
+
+    friend doublexN operator+(double s, const doublexN& a) { return doublexN(s) + a; }
+    friend doublexN operator-(double s, const doublexN& a) { return doublexN(s) - a; }
+    friend doublexN operator*(double s, const doublexN& a) { return doublexN(s) * a; }
+    friend doublexN operator/(double s, const doublexN& a) { return doublexN(s) / a; }
+
+    // Lane-wise comparisons produce masks
+    maskxN<N> operator<(const doublexN& o) const { maskxN<N> r; for (int i = 0; i < N; ++i) r.m[i] = -static_cast<long long>(v[i] < o.v[i]); return r; }
+    maskxN<N> operator>(const doublexN& o) const { maskxN<N> r; for (int i = 0; i < N; ++i) r.m[i] = -static_cast<long long>(v[i] > o.v[i]); return r; }
+    maskxN<N> operator<=(const doublexN& o) const { maskxN<N> r; for (int i = 0; i < N; ++i) r.m[i] = -static_cast<long long>(v[i] <= o.v[i]); return r; }
+    maskxN<N> operator>=(const doublexN& o) const { maskxN<N> r; for (int i = 0; i < N; ++i) r.m[i] = -static_cast<long long>(v[i] >= o.v[i]); return r; }
+
+    // Horizontal reductions
+    double hmin() const { double r = v[0]; for (int i = 1; i < N; ++i) r = std::min(r, v[i]); return r; }
+    double hmax() const { double r = v[0]; for (int i = 1; i < N; ++i) r = std::max(r, v[i]); return r; }
+    double hsum() const { double r = 0.0; for (int i = 0; i < N; ++i) r += v[i]; return r; }
+};
+
+template <int N>
+doublexN<N> min(const doublexN<N>& a, const doublexN<N>& b) {
+    doublexN<N> r;
+    for (int i = 0; i < N; ++i) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+
+template <int N>
+doublexN<N> max(const doublexN<N>& a, const doublexN<N>& b) {
+    doublexN<N> r;
+    for (int i = 0; i < N; ++i) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+    return r;
+}
+
+template <int N>
+doublexN<N> sqrt(const doublexN<N>& a) {
+    doublexN<N> r;
+    for (int i = 0; i < N; ++i) r.v[i] = std::sqrt(a.v[i]);
+    return r;
+}
+
+// Per-lane blend: picks a where the mask is set, b elsewhere
+template <int N>
+doublexN<N> select(const maskxN<N>& mask, const doublexN<N>& a, const doublexN<N>& b) {
+    doublexN<N> r;
+    for (int i = 0; i < N; ++i) r.v[i] = mask.m[i] ? a.v[i] : b.v[i];
+    return r;
+}
+
+template <int N>
+class vector3xN {
+public:
+    doublexN<N> x, y, z;
+
+    vector3xN() {}
+    vector3xN(const doublexN<N>& x, const doublexN<N>& y, const doublexN<N>& z) : x(x), y(y), z(z) {}
+    vector3xN(const vector3& v) : x(v.x), y(v.y), z(v.z) {} // broadcast
+
+    // Lane access
+    vector3 get(int i) const { return vector3(x.v[i], y.v[i], z.v[i]); }
+    void set(int i, const vector3& v) { x.v[i] = v.x; y.v[i] = v.y; z.v[i] = v.z; }
+
+    // Basic operations
+    vector3xN operator+(const vector3xN& o) const { return vector3xN(x + o.x, y + o.y, z + o.z); }
+    vector3xN operator-(const vector3xN& o) const { return vector3xN(x - o.x, y - o.y, z - o.z); }
+    vector3xN operator-() const { return vector3xN(-x, -y, -z); }
+    vector3xN operator*(const doublexN<N>& s) const { return vector3xN(x * s, y * s, z * s); }
+    friend vector3xN operator*(const doublexN<N>& s, const vector3xN& v) { return v * s; }
+    vector3xN operator*(const vector3xN& o) const { return vector3xN(x * o.x, y * o.y, z * o.z); } // element-wise
+    vector3xN operator/(const doublexN<N>& s) const { return *this * (1.0 / s); }
+
+    // Dot and cross product
+    doublexN<N> dot(const vector3xN& o) const {
+        return x * o.x + y * o.y + z * o.z;
+    }
+    vector3xN cross(const vector3xN& o) const {
+        return vector3xN(y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x);
+    }
+
+    // Utility
+    doublexN<N> length() const { return sqrt(dot(*this)); }
+    vector3xN unit() const { return *this / length(); }
+};
+
+template <int N>
+vector3xN<N> select(const maskxN<N>& mask, const vector3xN<N>& a, const vector3xN<N>& b) {
+    return vector3xN<N>(select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z));
+}
+
+using vec3x4 = vector3xN<4>;
+using vec3x8 = vector3xN<8>;
+
+#endif
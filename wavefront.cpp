@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+#include "wavefront.h"
+#include "utils.h"
+
+/* --------------- Queues --------------- */
+
+void RayQueue::clear() {
+    ox.clear(); oy.clear(); oz.clear();
+    dx.clear(); dy.clear(); dz.clear();
+    wr.clear(); wg.clear(); wb.clear();
+    pixel.clear();
+    depth.clear();
+}
+
+void RayQueue::push(const ray& r, const vector3& weight, int pixel_index, int ray_depth) {
+    ox.push_back(r.origin.x); oy.push_back(r.origin.y); oz.push_back(r.origin.z);
+    dx.push_back(r.direction.x); dy.push_back(r.direction.y); dz.push_back(r.direction.z);
+    wr.push_back(weight.x); wg.push_back(weight.y); wb.push_back(weight.z);
+    pixel.push_back(pixel_index);
+    depth.push_back(ray_depth);
+}
+
+void ShadowQueue::clear() {
+    px.clear(); py.clear(); pz.clear();
+    lx.clear(); ly.clear(); lz.clear();
+    cr.clear(); cg.clear(); cb.clear();
+    light.clear();
+    pixel.clear();
+}
+
+void ShadowQueue::push(const vector3& point, const LightSample& sample, const vector3& contribution, int pixel_index) {
+    px.push_back(point.x); py.push_back(point.y); pz.push_back(point.z);
+    lx.push_back(sample.position.x); ly.push_back(sample.position.y); lz.push_back(sample.position.z);
+    cr.push_back(contribution.x); cg.push_back(contribution.y); cb.push_back(contribution.z);
+    light.push_back(sample.light);
+    pixel.push_back(pixel_index);
+}
+
+/* --------------- Ray sorting --------------- */
+
+// Spreads the low 10 bits of v so that two zero bits separate each of them
+static uint32_t expand_bits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code of a point, quantised to a 1024^3 grid over `bounds`
+static uint32_t morton_code(const vector3& p, const AABB& bounds) {
+    vector3 extent = bounds.extent();
+    auto quantize = [](double v, double lo, double size) {
+        double f = size > 0.0 ? (v - lo) / size : 0.0;
+        return static_cast<uint32_t>(std::min(std::max(f * 1024.0, 0.0), 1023.0));
+    };
+    uint32_t x = quantize(p.x, bounds.min.x, extent.x);
+    uint32_t y = quantize(p.y, bounds.min.y, extent.y);
+    uint32_t z = quantize(p.z, bounds.min.z, extent.z);
+    return (expand_bits(x) << 2) | (expand_bits(y) << 1) | expand_bits(z);
+}
+
+void sort_rays(RayQueue& rays, const AABB& bounds, RayQueue& scratch) {
+    const size_t n = rays.size();
+    std::vector<std::pair<uint64_t, size_t>> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t octant = (rays.dx[i] < 0.0 ? 4 : 0) | (rays.dy[i] < 0.0 ? 2 : 0) | (rays.dz[i] < 0.0 ? 1 : 0);
+        uint64_t morton = morton_code(vector3(rays.ox[i], rays.oy[i], rays.oz[i]), bounds);
+        keys[i] = { (octant << 30) | morton, i };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    scratch.clear();
+    for (const auto& key : keys) {
+        size_t i = key.second;
+        scratch.push(rays.get_ray(i), rays.get_weight(i), rays.pixel[i], rays.depth[i]);
+    }
+    std::swap(rays, scratch);
+}
+
+/* --------------- Stages --------------- */
+
+// Camera rays for rows [y_begin, y_end), emitted in 4x4 pixel tiles so consecutive rays are coherent
+static void generate_camera_rays(const Scene& scene, const Camera& camera, int image_width, int image_height,
+                                 int y_begin, int y_end, int nbounces, int samples_per_pixel, RayQueue& queue) {
+    const int tile = 4;
+    const int samples = scene.enable_antialiasing ? samples_per_pixel : 1;
+
+    for (int ty = y_begin; ty < y_end; ty += tile) {
+        for (int tx = 0; tx < image_width; tx += tile) {
+            for (int s = 0; s < samples; ++s) {
+                for (int y = ty; y < std::min(ty + tile, y_end); ++y) {
+                    for (int x = tx; x < std::min(tx + tile, image_width); ++x) {
+                        std::pair<double, double> uv;
+                        if (scene.enable_antialiasing) {
+                            // Same jitter as the recursive renderer
+                            double u_offset = random_double(-1.0, 1.0);
+                            double v_offset = random_double(-1.0, 1.0);
+                            uv = normalize_pixel(x + u_offset, y + v_offset, image_width, image_height);
+                        } else {
+                            uv = normalize_pixel(x, y, image_width, image_height);
+                        }
+                        queue.push(camera.get_ray(uv.first, uv.second), vector3(1.0, 1.0, 1.0), y * image_width + x, nbounces);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Closest hit for every ray in the queue. Coherent queues are traced 16 rays at a time as packets,
+// the rest one by one, recording BVH node reuse in `cache`
+static void intersect(const Scene& scene, const RayQueue& rays, bool coherent, HitQueue& hits, PacketStats& packet_stats, NodeCache& cache) {
+    const size_t n = rays.size();
+    const double max_t = std::numeric_limits<double>::max();
+    hits.t.resize(n);
+    hits.shape.resize(n);
+
+    if (coherent) {
+        const int N = 16;
+        for (size_t base = 0; base < n; base += N) {
+            vector3xN<N> origin, direction;
+            maskxN<N> active;
+            for (int i = 0; i < N; ++i) {
+                size_t k = std::min(base + i, n - 1); // tail lanes repeat the last ray, masked off
+                active.set(i, base + i < n);
+                origin.set(i, vector3(rays.ox[k], rays.oy[k], rays.oz[k]));
+                direction.set(i, vector3(rays.dx[k], rays.dy[k], rays.dz[k]));
+            }
+
+            doublexN<N> t;
+            const Shape* hit_shapes[N];
+            maskxN<N> hit = scene.intersects(ray_packet<N>(origin, direction), active, t, hit_shapes, max_t, packet_stats);
+            for (int i = 0; i < N; ++i) {
+                if (!active[i]) continue;
+                hits.t[base + i] = t[i];
+                hits.shape[base + i] = hit[i] ? hit_shapes[i] : nullptr;
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        double t = 0;
+        std::shared_ptr<Shape> shape;
+        bool hit = scene.intersects(rays.get_ray(i), t, shape, max_t, &cache);
+        hits.t[i] = t;
+        hits.shape[i] = hit ? shape.get() : nullptr;
+    }
+}
+
+// Rank of each shape in (shape type, texture) order, so that sorting by rank groups hits by material
+static std::unordered_map<const Shape*, int> material_ranks(const Scene& scene) {
+    std::vector<const Shape*> shapes;
+    for (const auto& shape : scene.shapes) shapes.push_back(shape.get());
+    std::stable_sort(shapes.begin(), shapes.end(), [](const Shape* a, const Shape* b) {
+        if (a->get_type() != b->get_type()) return a->get_type() < b->get_type();
+        return a->material.texture.get() < b->material.texture.get();
+    });
+
+    std::unordered_map<const Shape*, int> ranks;
+    for (size_t i = 0; i < shapes.size(); ++i) ranks[shapes[i]] = static_cast<int>(i);
+    return ranks;
+}
+
+// Counting sort of the hits by material rank; misses go last
+static void sort_hits(const HitQueue& hits, const std::unordered_map<const Shape*, int>& ranks, int num_ranks,
+                      std::vector<int>& keys, std::vector<size_t>& order) {
+    const size_t n = hits.shape.size();
+    keys.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = hits.shape[i] ? ranks.at(hits.shape[i]) : num_ranks;
+    }
+
+    std::vector<size_t> offsets(num_ranks + 2, 0);
+    for (size_t i = 0; i < n; ++i) offsets[keys[i] + 1]++;
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    order.resize(n);
+    for (size_t i = 0; i < n; ++i) order[offsets[keys[i]]++] = i;
+}
+
+// Shades every hit in sorted order: background for misses, shadow rays for the local Blinn-Phong term,
+// and reflection/refraction rays (with their throughput) for the next wave
+static void shade(const Scene& scene, const RayQueue& rays, const HitQueue& hits, const std::vector<size_t>& order,
+                  std::vector<LightSample>& samples, ShadowQueue& shadows, RayQueue& next, std::vector<vector3>& accum) {
+    for (size_t i : order) {
+        const Shape* shape = hits.shape[i];
+        int pixel = rays.pixel[i];
+        vector3 weight = rays.get_weight(i);
+
+        if (scene.render_mode == RenderMode::Binary) {
+            if (shape) accum[pixel] += vector3(1.0, 0.0, 0.0); // red
+            continue;
+        }
+        if (!shape) {
+            accum[pixel] += weight * scene.backgroundcolor;
+            continue;
+        }
+
+        ray r = rays.get_ray(i);
+        vector3 hit_point = r.origin + hits.t[i] * r.direction;
+        vector3 normal = shape->get_normal(hit_point);
+        const Material& material = shape->material;
+
+        samples.clear();
+        scene.sample_lights(hit_point, normal, -r.direction.unit(), material, *shape, samples);
+        for (const auto& sample : samples) {
+            shadows.push(hit_point, sample, weight * sample.contribution, pixel);
+        }
+
+        // Same depth rules as compute_reflection/compute_refraction: children are traced at nbounces - 2
+        int depth = rays.depth[i];
+        if (depth - 1 <= 0) continue;
+
+        ray refracted(hit_point, normal);
+        bool refracts = material.isrefractive && scene.refract_ray(r, hit_point, normal, material, refracted);
+        bool reflects = material.isreflective;
+        double refract_weight = material.transparency;
+        double reflect_weight = material.reflectivity;
+
+        if (scene.stochastic_fresnel && reflects && refracts) {
+            double branch_weight;
+            if (scene.choose_reflection(r, normal, material, branch_weight)) {
+                refracts = false;
+                reflect_weight *= branch_weight;
+            } else {
+                reflects = false;
+                refract_weight *= branch_weight;
+            }
+        }
+
+        if (reflects) {
+            vector3 throughput = weight * reflect_weight;
+            if (scene.keep_ray(throughput)) {
+                next.push(scene.reflect_ray(r, hit_point, normal), throughput, pixel, depth - 2);
+            }
+        }
+        if (refracts) {
+            vector3 throughput = weight * refract_weight;
+            if (scene.keep_ray(throughput)) {
+                next.push(refracted, throughput, pixel, depth - 2);
+            }
+        }
+    }
+}
+
+static void trace_shadows(const Scene& scene, const ShadowQueue& shadows, std::vector<vector3>& accum) {
+    for (size_t i = 0; i < shadows.size(); ++i) {
+        vector3 point(shadows.px[i], shadows.py[i], shadows.pz[i]);
+        vector3 light_position(shadows.lx[i], shadows.ly[i], shadows.lz[i]);
+        double shadow_factor = scene.compute_shadow_factor(point, light_position, shadows.light[i]);
+        accum[shadows.pixel[i]] += shadow_factor * vector3(shadows.cr[i], shadows.cg[i], shadows.cb[i]);
+    }
+}
+
+/* --------------- Driver --------------- */
+
+void render_wavefront(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces,
+                      int samples_per_pixel, size_t batch_size, bool sort_secondary,
+                      std::vector<vector3>& framebuffer, WavefrontStats& stats) {
+    const auto ranks = material_ranks(scene);
+    const int num_ranks = static_cast<int>(scene.shapes.size());
+
+    AABB scene_bounds;
+    for (const auto& shape : scene.shapes) scene_bounds.merge(shape->get_bbox());
+
+    // Whole rows of 4x4 tiles per batch
+    int band_height = std::max<int>(4, static_cast<int>(batch_size / image_width) / 4 * 4);
+
+    std::vector<vector3> accum(framebuffer.size(), vector3(0.0, 0.0, 0.0));
+    const int bands = (image_height + band_height - 1) / band_height;
+
+    // Bands write disjoint pixels, so each thread runs whole bands through its own queues
+    #pragma omp parallel
+    {
+        RayQueue rays, next, scratch;
+        HitQueue hits;
+        ShadowQueue shadows;
+        std::vector<LightSample> samples;
+        std::vector<int> keys;
+        std::vector<size_t> order;
+        PacketStats packet_stats;
+        WavefrontStats thread_stats;
+
+        #pragma omp for schedule(dynamic)
+        for (int band = 0; band < bands; ++band) {
+            int y_begin = band * band_height;
+            int y_end = std::min(y_begin + band_height, image_height);
+
+            rays.clear();
+            generate_camera_rays(scene, camera, image_width, image_height, y_begin, y_end, nbounces, samples_per_pixel, rays);
+            thread_stats.camera_rays += rays.size();
+
+            bool primary = true;
+            while (rays.size() > 0) {
+                if (!primary && sort_secondary) {
+                    sort_rays(rays, scene_bounds, scratch);
+                }
+                intersect(scene, rays, primary, hits, packet_stats, thread_stats.secondary_node_cache);
+                sort_hits(hits, ranks, num_ranks, keys, order);
+
+                shadows.clear();
+                next.clear();
+                shade(scene, rays, hits, order, samples, shadows, next, accum);
+                trace_shadows(scene, shadows, accum);
+
+                thread_stats.waves++;
+                thread_stats.shadow_rays += shadows.size();
+                thread_stats.secondary_rays += next.size();
+                std::swap(rays, next);
+                primary = false;
+            }
+        }
+
+        #pragma omp critical
+        stats.merge(thread_stats);
+    }
+
+    const double sample_count = scene.enable_antialiasing ? samples_per_pixel : 1;
+    for (size_t i = 0; i < framebuffer.size(); ++i) {
+        framebuffer[i] = accum[i] / sample_count;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <vector>
+#include "vector3.h"
+#include "ray.h"
+#include "camera.h"
+#include "scene.h"
+
+// Rays waiting for the same stage, stored as structure-of-arrays so each kernel streams through memory
+struct RayQueue {
+    std::vector<double> ox, oy, oz;     // origin
+    std::vector<double> dx, dy, dz;     // direction
+    std::vector<double> wr, wg, wb;     // throughput from the camera to this ray
+    std::vector<int> pixel;
+    std::vector<int> depth;             // remaining nbounces
+
+    size_t size() const { return pixel.size(); }
+    void clear();
+    void push(const ray& r, const vector3& weight, int pixel_index, int ray_depth);
+
+    ray get_ray(size_t i) const { return ray(vector3(ox[i], oy[i], oz[i]), vector3(dx[i], dy[i], dz[i])); }
+    vector3 get_weight(size_t i) const { return vector3(wr[i], wg[i], wb[i]); }
+};
+
+// Closest hit for each entry of a RayQueue (same indexing); shape is null on a miss
+struct HitQueue {
+    std::vector<double> t;
+    std::vector<const Shape*> shape;
+};
+
+// Shadow rays together with the light they deliver to their pixel if unoccluded
+struct ShadowQueue {
+    std::vector<double> px, py, pz;     // shading point
+    std::vector<double> lx, ly, lz;     // light sample position
+    std::vector<double> cr, cg, cb;     // contribution, already weighted by the ray throughput
+    std::vector<const Light*> light;
+    std::vector<int> pixel;
+
+    size_t size() const { return pixel.size(); }
+    void clear();
+    void push(const vector3& point, const LightSample& sample, const vector3& contribution, int pixel_index);
+};
+
+struct WavefrontStats {
+    long waves = 0;
+    long camera_rays = 0;
+    long secondary_rays = 0;   // reflection + refraction
+    long shadow_rays = 0;
+    NodeCache secondary_node_cache; // BVH node reuse while tracing secondary rays (only traced with --bvh)
+
+    // Adds the counts of another thread's bands
+    void merge(const WavefrontStats& other) {
+        waves += other.waves;
+        camera_rays += other.camera_rays;
+        secondary_rays += other.secondary_rays;
+        shadow_rays += other.shadow_rays;
+        secondary_node_cache.merge(other.secondary_node_cache);
+    }
+};
+
+// Reorders a queue by direction octant, then by the Morton code of the origin within `bounds`,
+// so that rays traced one after another leave nearby points in similar directions
+void sort_rays(RayQueue& rays, const AABB& bounds, RayQueue& scratch);
+
+// Stream renderer: instead of recursing per pixel, every stage runs over a whole batch of rays
+// (intersect -> sort by material -> shade -> trace shadows) and spawns the next batch of secondaries.
+// `batch_size` is the number of pixels whose camera rays enter the pipeline together;
+// `sort_secondary` reorders each reflection/refraction wave with sort_rays before tracing it.
+// Bands of rows are independent and run in parallel, each thread with its own queues and node cache.
+void render_wavefront(const Scene& scene, const Camera& camera, int image_width, int image_height, int nbounces,
+                      int samples_per_pixel, size_t batch_size, bool sort_secondary,
+                      std::vector<vector3>& framebuffer, WavefrontStats& stats);
+
+#endif